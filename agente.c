@@ -5,33 +5,50 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define MIN_HOUR 7
 #define MAX_HOUR 19
 #define MAX_NAME_LEN 64
 #define MAX_FAMILY_LEN 64
 #define MAX_LINE_LEN 512
+#define TIPO_SOCKET SOCK_SEQPACKET
+#define MAX_PARQUE_LEN 32
 
 typedef struct {
     char nombre[MAX_NAME_LEN];
     char fileSolicitud[256];
     char pipeRecibe[256];
+    char socketPath[108];   // si se indica, se usa en lugar de pipeRecibe
     char fifoRespuesta[256];
+    char manifiesto[256];   // modo multiplexado: nombre,archivo[,parque]
+    char parque[MAX_PARQUE_LEN]; // "" = el parque por defecto del controlador
+    int hilos;              // 0: uno por nucleo
+    int pausaSeg;           // espera entre solicitudes de un mismo agente
 } ConfigAgente;
 
 static void uso(const char *prog) {
     fprintf(stderr,
-            "Uso: %s -s nombre -a fileSolicitud -p pipeRecibe\n",
-            prog);
+            "Uso: %s -s nombre -a fileSolicitud {-p pipeRecibe | -u socket} [-k parque] "
+            "[-d pausaSeg]\n"
+            "     %s -m manifiesto {-p pipeRecibe | -u socket} [-k parque] [-h hilos] "
+            "[-d pausaSeg]\n",
+            prog, prog);
 }
 
 static int parse_args(int argc, char *argv[], ConfigAgente *cfg) {
     int opt;
-    int got_s = 0, got_a = 0, got_p = 0;
+    int got_s = 0, got_a = 0, got_p = 0, got_m = 0;
 
     memset(cfg, 0, sizeof(*cfg));
+    cfg->pausaSeg = 2;
 
-    while ((opt = getopt(argc, argv, "s:a:p:")) != -1) {
+    while ((opt = getopt(argc, argv, "s:a:p:u:m:k:h:d:")) != -1) {
         switch (opt) {
             case 's':
                 strncpy(cfg->nombre, optarg, sizeof(cfg->nombre) - 1);
@@ -48,16 +65,49 @@ static int parse_args(int argc, char *argv[], ConfigAgente *cfg) {
                 cfg->pipeRecibe[sizeof(cfg->pipeRecibe) - 1] = '\0';
                 got_p = 1;
                 break;
+            case 'u':
+                if (strlen(optarg) >= sizeof(cfg->socketPath)) {
+                    fprintf(stderr, "Ruta de socket demasiado larga: %s\n", optarg);
+                    return -1;
+                }
+                strcpy(cfg->socketPath, optarg);
+                got_p = 1;
+                break;
+            case 'm':
+                strncpy(cfg->manifiesto, optarg, sizeof(cfg->manifiesto) - 1);
+                cfg->manifiesto[sizeof(cfg->manifiesto) - 1] = '\0';
+                got_m = 1;
+                break;
+            case 'k':
+                if (strlen(optarg) >= sizeof(cfg->parque) || strchr(optarg, '|')) {
+                    fprintf(stderr, "Id de parque invalido: %s\n", optarg);
+                    return -1;
+                }
+                strcpy(cfg->parque, optarg);
+                break;
+            case 'h':
+                cfg->hilos = atoi(optarg);
+                break;
+            case 'd':
+                cfg->pausaSeg = atoi(optarg);
+                break;
             default:
                 uso(argv[0]);
                 return -1;
         }
     }
 
-    if (!got_s || !got_a || !got_p) {
+    if (!got_p || (got_m ? (got_s || got_a) : (!got_s || !got_a))) {
         uso(argv[0]);
         return -1;
     }
+    if (cfg->hilos < 0 || cfg->pausaSeg < 0) {
+        fprintf(stderr, "Hilos y pausa deben ser >= 0.\n");
+        return -1;
+    }
+    if (got_m) {
+        return 0;
+    }
 
     if (cfg->nombre[0] == '\0') {
         fprintf(stderr, "Nombre de agente invalido.\n");
@@ -90,21 +140,63 @@ static int crear_fifo_respuesta(ConfigAgente *cfg) {
     return 0;
 }
 
-// Envia por el pipeRecibe un mensaje terminado en '\n'.
+// Conecta con el socket del controlador. La sesion sirve para enviar y
+// recibir; el controlador detecta de inmediato si se cierra.
+static int conectar_socket(const char *ruta) {
+    int fd = socket(AF_UNIX, TIPO_SOCKET, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.sun_family = AF_UNIX;
+    memcpy(dir.sun_path, ruta, strlen(ruta) + 1); // largo validado en parse_args
+    if (connect(fd, (struct sockaddr *)&dir, sizeof(dir)) == -1) {
+        perror("connect socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void quitar_fifo_respuesta(const ConfigAgente *cfg) {
+    if (cfg->fifoRespuesta[0] != '\0') {
+        unlink(cfg->fifoRespuesta);
+    }
+}
+
+// Envia por el pipeRecibe (o socket) un mensaje terminado en '\n'.
+// Se escribe en una sola llamada: el pipe es compartido por todos los agentes
+// y solo una escritura de hasta PIPE_BUF bytes es atomica.
 static int enviar_linea_controlador(int fdCtrl, const char *linea) {
-    size_t len = strlen(linea);
-    ssize_t written = write(fdCtrl, linea, len);
-    if (written != (ssize_t)len) {
-        perror("write pipeRecibe");
+    char buf[MAX_LINE_LEN + 1];
+    int len = snprintf(buf, sizeof(buf), "%s\n", linea);
+    if (len < 0 || len >= (int)sizeof(buf)) {
+        fprintf(stderr, "Mensaje demasiado largo: %s\n", linea);
         return -1;
     }
-    if (write(fdCtrl, "\n", 1) != 1) {
-        perror("write newline pipeRecibe");
+    ssize_t written = write(fdCtrl, buf, (size_t)len);
+    if (written != (ssize_t)len) {
+        perror("write pipeRecibe");
         return -1;
     }
     return 0;
 }
 
+// REG|nombre|fifoRespuesta[|parque]; por un socket el FIFO va vacio. El
+// parque hace que TIME traiga su hora.
+static void armar_registro(char *linea, size_t sz, const char *nombre, const char *fifo,
+                           const char *parque) {
+    int largo = snprintf(linea, sz, "REG|%s", nombre);
+    if (fifo[0] != '\0' || parque[0] != '\0') {
+        largo += snprintf(linea + largo, sz - (size_t)largo, "|%s", fifo);
+    }
+    if (parque[0] != '\0') {
+        snprintf(linea + largo, sz - (size_t)largo, "|%s", parque);
+    }
+}
+
 // Lee una linea del FIFO de respuesta (bloqueante).
 static int leer_linea_fifo(FILE *fp, char *buf, size_t sz) {
     if (!fgets(buf, (int)sz, fp)) {
@@ -119,8 +211,68 @@ static int leer_linea_fifo(FILE *fp, char *buf, size_t sz) {
     return 1;
 }
 
+// Lee del CSV la siguiente solicitud valida (Familia,hora,personas),
+// saltando comentarios y lineas invalidas. Devuelve 0 al llegar al final.
+static int leer_siguiente_solicitud(FILE *fpCSV, int horaActual, const char *prefijo,
+                                    char *familia, size_t famSz,
+                                    int *hora, int *personas) {
+    char lineaCSV[MAX_LINE_LEN];
+    while (fgets(lineaCSV, sizeof(lineaCSV), fpCSV)) {
+        trim_newline(lineaCSV);
+        if (lineaCSV[0] == '\0') continue;       // linea vacia
+        if (lineaCSV[0] == '#') continue;        // comentario
+
+        // Formato: Familia,hora,personas
+        char buf[MAX_LINE_LEN];
+        strncpy(buf, lineaCSV, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+
+        char *restCSV = NULL;
+        char *fam = strtok_r(buf, ",", &restCSV);
+        char *horaStrCSV = strtok_r(NULL, ",", &restCSV);
+        char *persStrCSV = strtok_r(NULL, ",", &restCSV);
+
+        if (!fam || !horaStrCSV || !persStrCSV) {
+            fprintf(stderr, "%sLinea CSV mal formada, se ignora: %s\n", prefijo, lineaCSV);
+            continue;
+        }
+
+        int h = atoi(horaStrCSV);
+        int p = atoi(persStrCSV);
+
+        if (h < MIN_HOUR || h > MAX_HOUR || p <= 0) {
+            fprintf(stderr, "%sSolicitud invalida en archivo (rango/aforo), se ignora: %s\n",
+                    prefijo, lineaCSV);
+            continue;
+        }
+
+        if (h < horaActual) {
+            printf("%sSolicitud ignorada por ser anterior a la hora actual (%d): %s\n",
+                   prefijo, horaActual, lineaCSV);
+            continue;
+        }
+
+        snprintf(familia, famSz, "%s", fam);
+        *hora = h;
+        *personas = p;
+        return 1;
+    }
+    return 0;
+}
+
+// END|motivo[|agente]: FIN_SIMULACION al terminar la simulacion, DESCONECTADO
+// si el controlador dejo de atender al agente por no consumir sus respuestas.
+static void imprimir_fin(const char *prefijo, const char *nombre, const char *linea) {
+    if (strncmp(linea, "END|DESCONECTADO", 16) == 0) {
+        printf("%sAgente %s termina (desconectado por el controlador).\n", prefijo, nombre);
+    } else {
+        printf("%sAgente %s termina (fin de simulación).\n", prefijo, nombre);
+    }
+}
+
 // Procesa y muestra un mensaje RESP|... de forma amigable.
-static void imprimir_respuesta(const char *linea) {
+// prefijo identifica al agente cuando un proceso maneja varios ("" si no).
+static void imprimir_respuesta(const char *prefijo, const char *linea) {
     char copia[MAX_LINE_LEN];
     strncpy(copia, linea, sizeof(copia) - 1);
     copia[sizeof(copia) - 1] = '\0';
@@ -130,7 +282,7 @@ static void imprimir_respuesta(const char *linea) {
     if (!tipo) return;
 
     if (strcmp(tipo, "RESP") != 0) {
-        fprintf(stderr, "Mensaje desconocido del controlador: %s\n", linea);
+        fprintf(stderr, "%sMensaje desconocido del controlador: %s\n", prefijo, linea);
         return;
     }
 
@@ -140,7 +292,7 @@ static void imprimir_respuesta(const char *linea) {
     char *horaFinStr = strtok_r(NULL, "|", &rest);
 
     if (!subtipo || !familia || !horaIniStr || !horaFinStr) {
-        fprintf(stderr, "Mensaje RESP mal formado: %s\n", linea);
+        fprintf(stderr, "%sMensaje RESP mal formado: %s\n", prefijo, linea);
         return;
     }
 
@@ -148,67 +300,529 @@ static void imprimir_respuesta(const char *linea) {
     int horaFin = atoi(horaFinStr);
 
     if (strcmp(subtipo, "OK") == 0) {
-        printf("Familia %s: reserva ACEPTADA de %d a %d horas.\n",
-               familia, horaIni, horaFin);
+        printf("%sFamilia %s: reserva ACEPTADA de %d a %d horas.\n",
+               prefijo, familia, horaIni, horaFin);
     } else if (strcmp(subtipo, "REPROG") == 0) {
-        printf("Familia %s: reserva REPROGRAMADA de %d a %d horas.\n",
-               familia, horaIni, horaFin);
+        printf("%sFamilia %s: reserva REPROGRAMADA de %d a %d horas.\n",
+               prefijo, familia, horaIni, horaFin);
     } else if (strcmp(subtipo, "NEG") == 0) {
-        printf("Familia %s: reserva NEGADA (sin cupo o parametros invalidos).\n",
-               familia);
+        printf("%sFamilia %s: reserva NEGADA (sin cupo o parametros invalidos).\n",
+               prefijo, familia);
     } else if (strcmp(subtipo, "NEG_EXTEMP") == 0) {
-        printf("Familia %s: reserva NEGADA por extemporanea, sin bloques alternativos.\n",
-               familia);
+        printf("%sFamilia %s: reserva NEGADA por extemporanea, sin bloques alternativos.\n",
+               prefijo, familia);
     } else {
-        printf("Respuesta desconocida del controlador: %s\n", linea);
+        printf("%sRespuesta desconocida del controlador: %s\n", prefijo, linea);
     }
 }
 
-int main(int argc, char *argv[]) {
-    ConfigAgente cfg;
-    if (parse_args(argc, argv, &cfg) != 0) {
-        return EXIT_FAILURE;
+// Muestra un aviso ENTER|familia|hora|personas|agente o EXIT|... que el
+// controlador envia en cada hora por las familias del agente que entran o
+// salen del parque. Devuelve 0 si la linea no es un aviso.
+static int imprimir_aviso(const char *prefijo, const char *linea) {
+    int entra = strncmp(linea, "ENTER|", 6) == 0;
+    if (!entra && strncmp(linea, "EXIT|", 5) != 0) return 0;
+
+    char copia[MAX_LINE_LEN];
+    snprintf(copia, sizeof(copia), "%s", linea);
+    char *rest = NULL;
+    strtok_r(copia, "|", &rest);
+    char *familia = strtok_r(NULL, "|", &rest);
+    char *horaStr = strtok_r(NULL, "|", &rest);
+    char *persStr = strtok_r(NULL, "|", &rest);
+    if (!familia || !horaStr || !persStr) {
+        fprintf(stderr, "%sAviso mal formado: %s\n", prefijo, linea);
+        return 1;
     }
+    printf("%sFamilia %s %s parque a las %s horas (%s personas).\n", prefijo, familia,
+           entra ? "entra al" : "sale del", horaStr, persStr);
+    return 1;
+}
 
-    if (crear_fifo_respuesta(&cfg) != 0) {
-        return EXIT_FAILURE;
+// Lee la siguiente linea que no sea un aviso de entrada/salida; los avisos
+// que lleguen antes se muestran.
+static int leer_mensaje_fifo(FILE *fp, char *buf, size_t sz) {
+    while (leer_linea_fifo(fp, buf, sz)) {
+        if (!imprimir_aviso("", buf)) return 1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Modo multiplexado (-m)
+//
+// Un solo proceso maneja muchos agentes logicos. Se reparten entre un hilo
+// por nucleo; cada hilo usa un unico FIFO de respuesta y un descriptor hacia
+// pipeRecibe para todos sus agentes. Las REQ llevan un id por agente y el
+// controlador devuelve agente e id en cada RESP, asi cada respuesta se
+// entrega al agente que la pidio. Cada agente conserva el comportamiento del
+// modo simple: una solicitud pendiente a la vez y pausaSeg entre solicitudes.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char nombre[MAX_NAME_LEN];
+    char archivo[256];
+    char parque[MAX_PARQUE_LEN];
+    FILE *fpCSV;
+    int horaActual;
+    int registrado;         // ya llego TIME
+    int agotado;            // no quedan solicitudes en el CSV
+    int terminado;          // ya llego END
+    unsigned long idEnVuelo;    // 0 si no hay solicitud pendiente
+    unsigned long siguienteId;
+    struct timespec proximoEnvio;
+} AgenteLogico;
+
+typedef struct {
+    int id;
+    const ConfigAgente *cfg;
+    AgenteLogico **agentes; // ordenados por nombre
+    int numAgentes;
+    char fifoRespuesta[256];
+} HiloAgentes;
+
+static int cargar_manifiesto(const char *ruta, const char *parqueDef, AgenteLogico **out) {
+    FILE *fp = fopen(ruta, "r");
+    if (!fp) {
+        perror("fopen manifiesto");
+        return -1;
+    }
+
+    AgenteLogico *agentes = NULL;
+    int n = 0, cap = 0;
+    char linea[MAX_LINE_LEN];
+    while (fgets(linea, sizeof(linea), fp)) {
+        trim_newline(linea);
+        if (linea[0] == '\0' || linea[0] == '#') continue;
+
+        // Formato: nombre,archivo[,parque] (sin parque se usa el de -k)
+        char *rest = NULL;
+        char *nombre = strtok_r(linea, ",", &rest);
+        char *archivo = strtok_r(NULL, ",", &rest);
+        char *parque = strtok_r(NULL, ",", &rest);
+        if (!nombre || !archivo || nombre[0] == '\0' ||
+            (parque && (strlen(parque) >= MAX_PARQUE_LEN || strchr(parque, '|')))) {
+            fprintf(stderr, "Linea de manifiesto mal formada, se ignora.\n");
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            AgenteLogico *tmp = realloc(agentes, (size_t)cap * sizeof(*agentes));
+            if (!tmp) {
+                perror("realloc manifiesto");
+                free(agentes);
+                fclose(fp);
+                return -1;
+            }
+            agentes = tmp;
+        }
+        AgenteLogico *a = &agentes[n++];
+        memset(a, 0, sizeof(*a));
+        snprintf(a->nombre, sizeof(a->nombre), "%s", nombre);
+        snprintf(a->archivo, sizeof(a->archivo), "%s", archivo);
+        snprintf(a->parque, sizeof(a->parque), "%s", parque ? parque : parqueDef);
+        a->horaActual = MIN_HOUR;
+        a->siguienteId = 1;
+    }
+    fclose(fp);
+
+    if (n == 0) {
+        fprintf(stderr, "El manifiesto no contiene agentes.\n");
+        free(agentes);
+        return -1;
+    }
+    *out = agentes;
+    return n;
+}
+
+static int comparar_agentes(const void *a, const void *b) {
+    const AgenteLogico *x = *(AgenteLogico *const *)a;
+    const AgenteLogico *y = *(AgenteLogico *const *)b;
+    return strcmp(x->nombre, y->nombre);
+}
+
+static AgenteLogico *buscar_agente_logico(HiloAgentes *h, const char *nombre) {
+    AgenteLogico clave;
+    AgenteLogico *pclave = &clave;
+    snprintf(clave.nombre, sizeof(clave.nombre), "%s", nombre);
+    AgenteLogico **r = bsearch(&pclave, h->agentes, (size_t)h->numAgentes,
+                               sizeof(*h->agentes), comparar_agentes);
+    return r ? *r : NULL;
+}
+
+static long ms_hasta(const struct timespec *t) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (t->tv_sec - ahora.tv_sec) * 1000 + (t->tv_nsec - ahora.tv_nsec) / 1000000;
+}
+
+// Procesa una linea recibida en el FIFO del hilo. Devuelve cuantos agentes
+// terminaron con ella.
+static int despachar_linea(HiloAgentes *h, const char *linea) {
+    char copia[MAX_LINE_LEN];
+    snprintf(copia, sizeof(copia), "%s", linea);
+
+    // Los campos de destino van al final: TIME|hora|agente,
+    // END|motivo|agente, RESP|tipo|familia|ini|fin|agente|id,
+    // ERR|REG|motivo|agente, ENTER|familia|hora|personas|agente (y EXIT)
+    char *campos[8] = {0};
+    int n = 0;
+    char *rest = NULL;
+    for (char *tok = strtok_r(copia, "|", &rest); tok && n < 8;
+         tok = strtok_r(NULL, "|", &rest)) {
+        campos[n++] = tok;
+    }
+    if (n == 0) return 0;
+
+    if (strcmp(campos[0], "END") == 0) {
+        int terminados = 0;
+        for (int i = 0; i < h->numAgentes; ++i) {
+            AgenteLogico *a = h->agentes[i];
+            if (a->terminado || (n >= 3 && strcmp(a->nombre, campos[2]) != 0)) continue;
+            char prefijo[MAX_NAME_LEN + 4];
+            snprintf(prefijo, sizeof(prefijo), "[%s] ", a->nombre);
+            imprimir_fin(prefijo, a->nombre, linea);
+            a->terminado = 1;
+            terminados++;
+        }
+        return terminados;
+    }
+    if (strcmp(campos[0], "ERR") == 0 && n >= 4) {
+        // El controlador rechazo el registro: ese agente no recibira TIME ni END
+        AgenteLogico *a = buscar_agente_logico(h, campos[3]);
+        if (!a || a->terminado) return 0;
+        fprintf(stderr, "[%s] El controlador rechazo el registro (%s).\n", a->nombre, campos[2]);
+        a->terminado = 1;
+        return 1;
+    }
+
+    const char *destino = NULL;
+    if (strcmp(campos[0], "TIME") == 0 && n >= 3) {
+        destino = campos[2];
+    } else if (strcmp(campos[0], "RESP") == 0 && n >= 7) {
+        destino = campos[5];
+    } else if ((strcmp(campos[0], "ENTER") == 0 || strcmp(campos[0], "EXIT") == 0) && n >= 5) {
+        destino = campos[4];
+    }
+    AgenteLogico *a = destino ? buscar_agente_logico(h, destino) : NULL;
+    if (!a) {
+        fprintf(stderr, "Mensaje sin agente destino conocido: %s\n", linea);
+        return 0;
+    }
+    char prefijo[MAX_NAME_LEN + 4];
+    snprintf(prefijo, sizeof(prefijo), "[%s] ", a->nombre);
+
+    if (imprimir_aviso(prefijo, linea)) {
+        return 0;
+    }
+    if (campos[0][0] == 'T') {
+        a->horaActual = atoi(campos[1]);
+        a->registrado = 1;
+        printf("%sAgente %s registrado. Hora actual de simulacion: %d\n",
+               prefijo, a->nombre, a->horaActual);
+        a->fpCSV = fopen(a->archivo, "r");
+        if (!a->fpCSV) {
+            fprintf(stderr, "%sfopen %s: %s\n", prefijo, a->archivo, strerror(errno));
+            a->agotado = 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &a->proximoEnvio);
+        return 0;
+    }
+
+    if (strtoul(campos[6], NULL, 10) != a->idEnVuelo) {
+        fprintf(stderr, "%sRespuesta con id inesperado: %s\n", prefijo, linea);
+        return 0;
     }
+    imprimir_respuesta(prefijo, linea);
+    a->idEnVuelo = 0;
+    clock_gettime(CLOCK_MONOTONIC, &a->proximoEnvio);
+    a->proximoEnvio.tv_sec += h->cfg->pausaSeg;
+    return 0;
+}
+
+// Envia la siguiente REQ de cada agente listo y devuelve los milisegundos
+// hasta que otro agente quede listo (-1 si ninguno espera por tiempo).
+static long enviar_solicitudes_listas(HiloAgentes *h, int fdCtrl) {
+    long espera = -1;
+    for (int i = 0; i < h->numAgentes; ++i) {
+        AgenteLogico *a = h->agentes[i];
+        if (!a->registrado || a->terminado || a->agotado || a->idEnVuelo != 0) continue;
+
+        long ms = ms_hasta(&a->proximoEnvio);
+        if (ms > 0) {
+            if (espera == -1 || ms < espera) espera = ms;
+            continue;
+        }
+
+        char prefijo[MAX_NAME_LEN + 4];
+        snprintf(prefijo, sizeof(prefijo), "[%s] ", a->nombre);
+        char familia[MAX_FAMILY_LEN];
+        int hora, personas;
+        if (!leer_siguiente_solicitud(a->fpCSV, a->horaActual, prefijo,
+                                      familia, sizeof(familia), &hora, &personas)) {
+            a->agotado = 1;
+            fclose(a->fpCSV);
+            a->fpCSV = NULL;
+            continue;
+        }
 
-    // Abrir FIFO de respuesta en modo lectura/escritura.
-    // Usar O_RDWR evita bloqueos y hace que el FIFO siempre tenga
-    // al menos un lector y un escritor, facilitando que el controlador
-    // pueda abrirlo en modo solo escritura.
-    int fdResp = open(cfg.fifoRespuesta, O_RDWR);
-    if (fdResp == -1) {
+        char linea[MAX_LINE_LEN];
+        unsigned long id = a->siguienteId++;
+        int largo = snprintf(linea, sizeof(linea), "REQ|%s|%s|%d|%d|%lu",
+                             a->nombre, familia, hora, personas, id);
+        if (a->parque[0] != '\0') {
+            snprintf(linea + largo, sizeof(linea) - (size_t)largo, "|%s", a->parque);
+        }
+        if (enviar_linea_controlador(fdCtrl, linea) != 0) {
+            return -2;
+        }
+        a->idEnVuelo = id;
+    }
+    return espera;
+}
+
+static int abrir_fifos_hilo(HiloAgentes *h, int *fdResp, int *fdCtrl) {
+    snprintf(h->fifoRespuesta, sizeof(h->fifoRespuesta),
+             "/tmp/agente_mux_%d_%d.fifo", (int)getpid(), h->id);
+    if (mkfifo(h->fifoRespuesta, 0666) == -1 && errno != EEXIST) {
+        perror("mkfifo (fifoRespuesta)");
+        return -1;
+    }
+    // O_RDWR por la misma razon que en el modo simple
+    *fdResp = open(h->fifoRespuesta, O_RDWR);
+    if (*fdResp == -1) {
         perror("open fifoRespuesta");
-        unlink(cfg.fifoRespuesta);
-        return EXIT_FAILURE;
+        unlink(h->fifoRespuesta);
+        return -1;
+    }
+    *fdCtrl = open(h->cfg->pipeRecibe, O_WRONLY);
+    if (*fdCtrl == -1) {
+        perror("open pipeRecibe");
+        close(*fdResp);
+        unlink(h->fifoRespuesta);
+        return -1;
     }
+    return 0;
+}
 
-    FILE *fpResp = fdopen(fdResp, "r");
-    if (!fpResp) {
-        perror("fdopen fifoRespuesta");
+static void *hilo_multiplexado(void *arg) {
+    HiloAgentes *h = (HiloAgentes *)arg;
+
+    int fdResp, fdCtrl;
+    if (h->cfg->socketPath[0] != '\0') {
+        // Una sesion por hilo para todos sus agentes
+        fdCtrl = conectar_socket(h->cfg->socketPath);
+        if (fdCtrl == -1) {
+            return NULL;
+        }
+        fdResp = fdCtrl;
+    } else if (abrir_fifos_hilo(h, &fdResp, &fdCtrl) != 0) {
+        return NULL;
+    }
+
+    int activos = h->numAgentes;
+    for (int i = 0; i < h->numAgentes; ++i) {
+        char linea[MAX_LINE_LEN];
+        armar_registro(linea, sizeof(linea), h->agentes[i]->nombre, h->fifoRespuesta,
+                       h->agentes[i]->parque);
+        if (enviar_linea_controlador(fdCtrl, linea) != 0) {
+            activos = 0;
+            break;
+        }
+    }
+
+    // Con socket SEQPACKET cada read trae un paquete completo: el buffer debe
+    // admitir el mas grande que envia el controlador (4096)
+    char buf[16 * MAX_LINE_LEN];
+    size_t len = 0;
+    while (activos > 0) {
+        long espera = enviar_solicitudes_listas(h, fdCtrl);
+        if (espera == -2) {
+            fprintf(stderr, "Hilo %d: se perdio la conexion con el controlador.\n", h->id);
+            break;
+        }
+
+        struct pollfd pfd = {fdResp, POLLIN, 0};
+        if (poll(&pfd, 1, (int)espera) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll respuestas");
+            break;
+        }
+        if (!(pfd.revents & POLLIN)) continue;
+
+        ssize_t n = read(fdResp, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            if (n == 0) {
+                fprintf(stderr, "Hilo %d: el controlador cerro la sesion.\n", h->id);
+            } else {
+                perror("read respuestas");
+            }
+            break;
+        }
+        len += (size_t)n;
+
+        size_t inicio = 0;
+        for (size_t i = 0; i < len; ++i) {
+            if (buf[i] != '\n') continue;
+            buf[i] = '\0';
+            activos -= despachar_linea(h, buf + inicio);
+            inicio = i + 1;
+        }
+        memmove(buf, buf + inicio, len - inicio);
+        len -= inicio;
+        if (len == sizeof(buf) - 1) {
+            fprintf(stderr, "Hilo %d: linea demasiado larga, se descarta.\n", h->id);
+            len = 0;
+        }
+    }
+
+    for (int i = 0; i < h->numAgentes; ++i) {
+        if (h->agentes[i]->fpCSV) {
+            fclose(h->agentes[i]->fpCSV);
+            h->agentes[i]->fpCSV = NULL;
+        }
+    }
+    close(fdCtrl);
+    if (fdResp != fdCtrl) {
         close(fdResp);
-        unlink(cfg.fifoRespuesta);
+        unlink(h->fifoRespuesta);
+    }
+    return NULL;
+}
+
+static int ejecutar_multiplexado(const ConfigAgente *cfg) {
+    AgenteLogico *agentes = NULL;
+    int numAgentes = cargar_manifiesto(cfg->manifiesto, cfg->parque, &agentes);
+    if (numAgentes < 0) {
         return EXIT_FAILURE;
     }
 
-    // Abrir pipeRecibe para escritura (hacia el controlador)
-    int fdCtrl = open(cfg.pipeRecibe, O_WRONLY);
-    if (fdCtrl == -1) {
-        perror("open pipeRecibe");
-        fclose(fpResp);
-        unlink(cfg.fifoRespuesta);
+    int hilos = cfg->hilos;
+    if (hilos == 0) {
+        long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+        hilos = nucleos > 0 ? (int)nucleos : 1;
+    }
+    if (hilos > numAgentes) hilos = numAgentes;
+
+    // Si el controlador termina, write devuelve EPIPE en lugar de matar el proceso
+    signal(SIGPIPE, SIG_IGN);
+
+    HiloAgentes *h = calloc((size_t)hilos, sizeof(*h));
+    AgenteLogico **asignados = calloc((size_t)numAgentes, sizeof(*asignados));
+    pthread_t *thr = calloc((size_t)hilos, sizeof(*thr));
+    if (!h || !asignados || !thr) {
+        perror("calloc");
+        free(h);
+        free(asignados);
+        free(thr);
+        free(agentes);
+        return EXIT_FAILURE;
+    }
+
+    // Reparto contiguo: el hilo t recibe los agentes [ini, fin)
+    int k = 0;
+    for (int t = 0; t < hilos; ++t) {
+        int cuantos = numAgentes / hilos + (t < numAgentes % hilos ? 1 : 0);
+        h[t].id = t;
+        h[t].cfg = cfg;
+        h[t].agentes = &asignados[k];
+        h[t].numAgentes = cuantos;
+        for (int i = 0; i < cuantos; ++i, ++k) {
+            asignados[k] = &agentes[k];
+        }
+        qsort(h[t].agentes, (size_t)cuantos, sizeof(*h[t].agentes), comparar_agentes);
+    }
+
+    printf("Agente multiplexado: %d agentes en %d hilo(s).\n", numAgentes, hilos);
+    int creados = 0;
+    for (; creados < hilos; ++creados) {
+        if (pthread_create(&thr[creados], NULL, hilo_multiplexado, &h[creados]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    for (int t = 0; t < creados; ++t) {
+        pthread_join(thr[t], NULL);
+    }
+
+    free(thr);
+    free(asignados);
+    free(h);
+    free(agentes);
+    return creados == hilos ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+    ConfigAgente cfg;
+    if (parse_args(argc, argv, &cfg) != 0) {
         return EXIT_FAILURE;
     }
 
+    if (cfg.manifiesto[0] != '\0') {
+        return ejecutar_multiplexado(&cfg);
+    }
+
+    int fdResp, fdCtrl;
+    FILE *fpResp;
+    if (cfg.socketPath[0] != '\0') {
+        // Una sola sesion: las respuestas llegan por el mismo socket
+        fdCtrl = conectar_socket(cfg.socketPath);
+        if (fdCtrl == -1) {
+            return EXIT_FAILURE;
+        }
+        fdResp = dup(fdCtrl);
+        fpResp = fdResp != -1 ? fdopen(fdResp, "r") : NULL;
+        if (!fpResp) {
+            perror("fdopen socket");
+            if (fdResp != -1) close(fdResp);
+            close(fdCtrl);
+            return EXIT_FAILURE;
+        }
+        // Cada paquete (hasta 4096 bytes) debe caber entero en el buffer de stdio
+        setvbuf(fpResp, NULL, _IOFBF, 16 * MAX_LINE_LEN);
+    } else {
+        if (crear_fifo_respuesta(&cfg) != 0) {
+            return EXIT_FAILURE;
+        }
+
+        // Abrir FIFO de respuesta en modo lectura/escritura.
+        // Usar O_RDWR evita bloqueos y hace que el FIFO siempre tenga
+        // al menos un lector y un escritor, facilitando que el controlador
+        // pueda abrirlo en modo solo escritura.
+        fdResp = open(cfg.fifoRespuesta, O_RDWR);
+        if (fdResp == -1) {
+            perror("open fifoRespuesta");
+            quitar_fifo_respuesta(&cfg);
+            return EXIT_FAILURE;
+        }
+
+        fpResp = fdopen(fdResp, "r");
+        if (!fpResp) {
+            perror("fdopen fifoRespuesta");
+            close(fdResp);
+            quitar_fifo_respuesta(&cfg);
+            return EXIT_FAILURE;
+        }
+
+        // Abrir pipeRecibe para escritura (hacia el controlador)
+        fdCtrl = open(cfg.pipeRecibe, O_WRONLY);
+        if (fdCtrl == -1) {
+            perror("open pipeRecibe");
+            fclose(fpResp);
+            quitar_fifo_respuesta(&cfg);
+            return EXIT_FAILURE;
+        }
+    }
+
     // Enviar mensaje de registro
     char linea[MAX_LINE_LEN];
-    snprintf(linea, sizeof(linea), "REG|%s|%s", cfg.nombre, cfg.fifoRespuesta);
+    armar_registro(linea, sizeof(linea), cfg.nombre,
+                   cfg.socketPath[0] != '\0' ? "" : cfg.fifoRespuesta, cfg.parque);
     if (enviar_linea_controlador(fdCtrl, linea) != 0) {
         close(fdCtrl);
         fclose(fpResp);
-        unlink(cfg.fifoRespuesta);
+        quitar_fifo_respuesta(&cfg);
         return EXIT_FAILURE;
     }
 
@@ -218,7 +832,7 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "No se pudo leer TIME desde el controlador.\n");
         close(fdCtrl);
         fclose(fpResp);
-        unlink(cfg.fifoRespuesta);
+        quitar_fifo_respuesta(&cfg);
         return EXIT_FAILURE;
     }
 
@@ -227,11 +841,18 @@ int main(int argc, char *argv[]) {
     copia[sizeof(copia) - 1] = '\0';
     char *rest = NULL;
     char *tipo = strtok_r(copia, "|", &rest);
+    if (tipo && strcmp(tipo, "ERR") == 0) {
+        fprintf(stderr, "El controlador rechazo el registro de %s: %s\n", cfg.nombre, linea);
+        close(fdCtrl);
+        fclose(fpResp);
+        unlink(cfg.fifoRespuesta);
+        return EXIT_FAILURE;
+    }
     if (!tipo || strcmp(tipo, "TIME") != 0) {
         fprintf(stderr, "Mensaje inesperado del controlador (se esperaba TIME): %s\n", linea);
         close(fdCtrl);
         fclose(fpResp);
-        unlink(cfg.fifoRespuesta);
+        quitar_fifo_respuesta(&cfg);
         return EXIT_FAILURE;
     }
     char *horaStr = strtok_r(NULL, "|", &rest);
@@ -239,7 +860,7 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Mensaje TIME mal formado: %s\n", linea);
         close(fdCtrl);
         fclose(fpResp);
-        unlink(cfg.fifoRespuesta);
+        quitar_fifo_respuesta(&cfg);
         return EXIT_FAILURE;
     }
     horaActual = atoi(horaStr);
@@ -252,89 +873,62 @@ int main(int argc, char *argv[]) {
         perror("fopen fileSolicitud");
         close(fdCtrl);
         fclose(fpResp);
-        unlink(cfg.fifoRespuesta);
+        quitar_fifo_respuesta(&cfg);
         return EXIT_FAILURE;
     }
 
     // Bucle de lectura del archivo CSV y envio de solicitudes
-    char lineaCSV[MAX_LINE_LEN];
-    while (fgets(lineaCSV, sizeof(lineaCSV), fpCSV)) {
-        trim_newline(lineaCSV);
-        if (lineaCSV[0] == '\0') continue;       // linea vacia
-        if (lineaCSV[0] == '#') continue;        // comentario
-
-        // Formato: Familia,hora,personas
-        char buf[MAX_LINE_LEN];
-        strncpy(buf, lineaCSV, sizeof(buf) - 1);
-        buf[sizeof(buf) - 1] = '\0';
-
-        char *restCSV = NULL;
-        char *familia = strtok_r(buf, ",", &restCSV);
-        char *horaStrCSV = strtok_r(NULL, ",", &restCSV);
-        char *persStrCSV = strtok_r(NULL, ",", &restCSV);
-
-        if (!familia || !horaStrCSV || !persStrCSV) {
-            fprintf(stderr, "Linea CSV mal formada, se ignora: %s\n", lineaCSV);
-            continue;
-        }
-
-        int hora = atoi(horaStrCSV);
-        int personas = atoi(persStrCSV);
-
-        if (hora < MIN_HOUR || hora > MAX_HOUR || personas <= 0) {
-            fprintf(stderr, "Solicitud invalida en archivo (rango/aforo), se ignora: %s\n",
-                    lineaCSV);
-            continue;
-        }
-
-        if (hora < horaActual) {
-            printf("Solicitud ignorada por ser anterior a la hora actual (%d): %s\n",
-                   horaActual, lineaCSV);
-            continue;
+    char familia[MAX_FAMILY_LEN];
+    int hora, personas;
+    while (leer_siguiente_solicitud(fpCSV, horaActual, "", familia, sizeof(familia),
+                                    &hora, &personas)) {
+        // Enviar solicitud REQ; el parque va con el id de solicitud vacio
+        if (cfg.parque[0] != '\0') {
+            snprintf(linea, sizeof(linea), "REQ|%s|%s|%d|%d||%s",
+                     cfg.nombre, familia, hora, personas, cfg.parque);
+        } else {
+            snprintf(linea, sizeof(linea), "REQ|%s|%s|%d|%d",
+                     cfg.nombre, familia, hora, personas);
         }
-
-        // Enviar solicitud REQ
-        snprintf(linea, sizeof(linea), "REQ|%s|%s|%d|%d",
-                 cfg.nombre, familia, hora, personas);
         if (enviar_linea_controlador(fdCtrl, linea) != 0) {
             break;
         }
 
         // Esperar respuesta o posible END
-        if (!leer_linea_fifo(fpResp, linea, sizeof(linea))) {
+        if (!leer_mensaje_fifo(fpResp, linea, sizeof(linea))) {
             fprintf(stderr, "No se pudo leer respuesta del controlador.\n");
             break;
         }
 
-        if (strncmp(linea, "END|FIN_SIMULACION", 18) == 0) {
-            printf("Agente %s termina (fin de simulación).\n", cfg.nombre);
+        if (strncmp(linea, "END|", 4) == 0) {
+            imprimir_fin("", cfg.nombre, linea);
             fclose(fpCSV);
             close(fdCtrl);
             fclose(fpResp);
-            unlink(cfg.fifoRespuesta);
+            quitar_fifo_respuesta(&cfg);
             return EXIT_SUCCESS;
         }
 
-        imprimir_respuesta(linea);
-        sleep(2);
+        imprimir_respuesta("", linea);
+        sleep((unsigned)cfg.pausaSeg);
     }
 
     fclose(fpCSV);
 
     // Esperar mensaje de fin de simulación
-    while (leer_linea_fifo(fpResp, linea, sizeof(linea))) {
-        if (strncmp(linea, "END|FIN_SIMULACION", 18) == 0) {
-            printf("Agente %s termina (fin de simulación).\n", cfg.nombre);
+    while (leer_mensaje_fifo(fpResp, linea, sizeof(linea))) {
+        if (strncmp(linea, "END|", 4) == 0) {
+            imprimir_fin("", cfg.nombre, linea);
             break;
         } else {
             // Podrían llegar respuestas pendientes si el archivo terminó antes.
-            imprimir_respuesta(linea);
+            imprimir_respuesta("", linea);
         }
     }
 
     close(fdCtrl);
     fclose(fpResp);
-    unlink(cfg.fifoRespuesta);
+    quitar_fifo_respuesta(&cfg);
 
     return EXIT_SUCCESS;
 }
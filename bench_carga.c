@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+// Prueba de carga del controlador por su entrada real: para cada cantidad de
+// fragmentos de -h lanza ./controlador con varios parques (-k) y agentes
+// sinteticos que se registran y envian REQ (y QUERY) por sesiones de socket o
+// por el FIFO de su parque, con a lo sumo "ventana" solicitudes sin respuesta
+// cada uno. Mide desde que todos estan registrados hasta la ultima respuesta.
+// Las horas duran una hora real, asi que el reloj no interviene.
+
+#define MAX_PARQUES 64
+#define MAX_LISTA_H 16
+#define MAX_AGENTES_CARGA 4096
+#define LOTE_FIFO 4096          // PIPE_BUF: cada write al FIFO de entrada es atomico
+#define PLAZO_MS 60000          // sin completar en este tiempo se aborta la medida
+
+typedef enum {
+    TRANSPORTE_SOCKET = 0,
+    TRANSPORTE_FIFO
+} Transporte;
+
+typedef struct {
+    const char *controlador;
+    int parques;
+    int aforo;
+    int fragmentos[MAX_LISTA_H];
+    int numFragmentos;
+    int agentes;
+    int mensajes;
+    int ventana;
+    int pctConsultas;
+    int pctOtroParque;
+    Transporte transporte;
+    int hilos;
+} ConfigBench;
+
+typedef struct {
+    char nombre[32];
+    int parque;
+    int fdEnvio;            // su sesion, o el FIFO de entrada de su parque (compartido)
+    int fdRecibe;           // su sesion, o su FIFO de respuesta
+    char fifoResp[128];
+    long enviadas;
+    long recibidas;         // RESP y DISP
+    int registrado;         // llego su TIME
+    int fallo;              // ERR o END: el controlador lo rechazo o desconecto
+    char cabecera[4];       // primeros caracteres de la linea que se esta leyendo
+    int largoCabecera;
+    unsigned semilla;
+} AgenteCarga;
+
+typedef struct {
+    AgenteCarga *agentes;
+    int num;
+    int error;
+} HiloCarga;
+
+static ConfigBench cfg;
+static char base[64];       // prefijo de los archivos temporales de esta ejecucion
+static char idsParque[MAX_PARQUES][16];
+static int fdEntradaParque[MAX_PARQUES] = {0};
+static pthread_barrier_t barrera;
+
+static void uso(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-C controlador] [-P parques] [-a aforo] [-h fragmentos,...] "
+            "[-n agentes] [-m mensajesPorAgente] [-v ventana] [-c %%consultas] "
+            "[-x %%otroParque] [-t socket|fifo] [-j hilos]\n",
+            prog);
+}
+
+static int parse_lista(const char *s) {
+    cfg.numFragmentos = 0;
+    while (*s && cfg.numFragmentos < MAX_LISTA_H) {
+        int h = atoi(s);
+        if (h <= 0) return -1;
+        cfg.fragmentos[cfg.numFragmentos++] = h;
+        s = strchr(s, ',');
+        if (!s) break;
+        s++;
+    }
+    return cfg.numFragmentos > 0 ? 0 : -1;
+}
+
+static int parse_args(int argc, char *argv[]) {
+    int opt;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    cfg.controlador = "./controlador";
+    cfg.parques = 8;
+    cfg.aforo = 1000;
+    parse_lista("1,2,4,8");
+    cfg.agentes = 64;
+    cfg.mensajes = 5000;
+    cfg.ventana = 32;
+    cfg.pctConsultas = 0;
+    cfg.pctOtroParque = 0;
+    cfg.transporte = TRANSPORTE_SOCKET;
+    cfg.hilos = cpus > 0 ? (int)cpus : 1;
+
+    while ((opt = getopt(argc, argv, "C:P:a:h:n:m:v:c:x:t:j:")) != -1) {
+        switch (opt) {
+            case 'C':
+                cfg.controlador = optarg;
+                break;
+            case 'P':
+                cfg.parques = atoi(optarg);
+                break;
+            case 'a':
+                cfg.aforo = atoi(optarg);
+                break;
+            case 'h':
+                if (parse_lista(optarg) != 0) {
+                    uso(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'n':
+                cfg.agentes = atoi(optarg);
+                break;
+            case 'm':
+                cfg.mensajes = atoi(optarg);
+                break;
+            case 'v':
+                cfg.ventana = atoi(optarg);
+                break;
+            case 'c':
+                cfg.pctConsultas = atoi(optarg);
+                break;
+            case 'x':
+                cfg.pctOtroParque = atoi(optarg);
+                break;
+            case 't':
+                if (strcmp(optarg, "socket") == 0) {
+                    cfg.transporte = TRANSPORTE_SOCKET;
+                } else if (strcmp(optarg, "fifo") == 0) {
+                    cfg.transporte = TRANSPORTE_FIFO;
+                } else {
+                    uso(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'j':
+                cfg.hilos = atoi(optarg);
+                break;
+            default:
+                uso(argv[0]);
+                return -1;
+        }
+    }
+
+    if (cfg.parques <= 0 || cfg.parques > MAX_PARQUES || cfg.aforo <= 0 ||
+        cfg.agentes <= 0 || cfg.agentes > MAX_AGENTES_CARGA || cfg.mensajes <= 0 ||
+        cfg.ventana <= 0 || cfg.pctConsultas < 0 || cfg.pctConsultas > 100 ||
+        cfg.pctOtroParque < 0 || cfg.pctOtroParque > 100 || cfg.hilos <= 0) {
+        uso(argv[0]);
+        return -1;
+    }
+    if (cfg.hilos > cfg.agentes) cfg.hilos = cfg.agentes;
+    return 0;
+}
+
+static double ms_entre(const struct timespec *t0, const struct timespec *t1) {
+    return (t1->tv_sec - t0->tv_sec) * 1e3 + (t1->tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static int escribir_todo(int fd, const char *datos, size_t largo) {
+    while (largo > 0) {
+        ssize_t w = write(fd, datos, largo);
+        if (w == -1 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        datos += w;
+        largo -= (size_t)w;
+    }
+    return 0;
+}
+
+// Horas de una hora real: ninguna transcurre durante la medida.
+static int escribir_parques(const char *ruta) {
+    FILE *f = fopen(ruta, "w");
+    if (!f) {
+        perror("fopen parques");
+        return -1;
+    }
+    for (int i = 0; i < cfg.parques; ++i) {
+        snprintf(idsParque[i], sizeof(idsParque[i]), "p%d", i);
+        fprintf(f, "%s,7,19,3600,%d\n", idsParque[i], cfg.aforo);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static pid_t lanzar_controlador(int fragmentos) {
+    char parques[96], pipe[96], sock[96], h[16];
+    snprintf(parques, sizeof(parques), "%s.parques", base);
+    snprintf(pipe, sizeof(pipe), "%s.in", base);
+    snprintf(sock, sizeof(sock), "%s.sock", base);
+    snprintf(h, sizeof(h), "%d", fragmentos);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        // Su salida (una linea por solicitud) no interesa aqui
+        int nulo = open("/dev/null", O_WRONLY);
+        if (nulo != -1) {
+            dup2(nulo, STDOUT_FILENO);
+            dup2(nulo, STDERR_FILENO);
+        }
+        execl(cfg.controlador, cfg.controlador, "-k", parques, "-h", h, "-p", pipe, "-u", sock,
+              (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int conectar_socket(void) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    struct sockaddr_un dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.sun_family = AF_UNIX;
+    snprintf(dir.sun_path, sizeof(dir.sun_path), "%s.sock", base);
+    if (connect(fd, (struct sockaddr *)&dir, sizeof(dir)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Espera a que el controlador escuche y, con FIFOs, abre la entrada de cada
+// parque (ruta.id, que atiende el fragmento del parque).
+static int esperar_controlador(pid_t pid) {
+    for (int intento = 0; intento < 500; ++intento) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            fprintf(stderr, "El controlador termino al iniciar (%s).\n", cfg.controlador);
+            return -1;
+        }
+        int fd = conectar_socket();
+        if (fd != -1) {
+            close(fd);
+            break;
+        }
+        usleep(10000);
+    }
+    for (int i = 0; cfg.transporte == TRANSPORTE_FIFO && i < cfg.parques; ++i) {
+        char ruta[128];
+        snprintf(ruta, sizeof(ruta), "%s.in.%s", base, idsParque[i]);
+        fdEntradaParque[i] = open(ruta, O_WRONLY | O_CLOEXEC);
+        if (fdEntradaParque[i] == -1) {
+            perror("open FIFO de parque");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int conectar_agente(AgenteCarga *a, int indice) {
+    memset(a, 0, sizeof(*a));
+    snprintf(a->nombre, sizeof(a->nombre), "b%d", indice);
+    a->parque = indice % cfg.parques;
+    a->semilla = (unsigned)indice * 2654435761u + 1;
+
+    char reg[256];
+    int largo;
+    if (cfg.transporte == TRANSPORTE_SOCKET) {
+        a->fdEnvio = a->fdRecibe = conectar_socket();
+        if (a->fdEnvio == -1) {
+            perror("connect");
+            return -1;
+        }
+        largo = snprintf(reg, sizeof(reg), "REG|%s||%s\n", a->nombre, idsParque[a->parque]);
+    } else {
+        snprintf(a->fifoResp, sizeof(a->fifoResp), "%s.r%d", base, indice);
+        unlink(a->fifoResp);
+        if (mkfifo(a->fifoResp, 0600) == -1) {
+            perror("mkfifo");
+            return -1;
+        }
+        a->fdRecibe = open(a->fifoResp, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (a->fdRecibe == -1) {
+            perror("open FIFO de respuesta");
+            return -1;
+        }
+        a->fdEnvio = fdEntradaParque[a->parque];
+        largo = snprintf(reg, sizeof(reg), "REG|%s|%s|%s\n", a->nombre, a->fifoResp,
+                         idsParque[a->parque]);
+    }
+    return escribir_todo(a->fdEnvio, reg, (size_t)largo);
+}
+
+static void cerrar_agente(AgenteCarga *a) {
+    if (a->fdRecibe > 0) close(a->fdRecibe);
+    if (a->fifoResp[0] != '\0') unlink(a->fifoResp);
+}
+
+static unsigned siguiente_azar(AgenteCarga *a) {
+    a->semilla = a->semilla * 1103515245u + 12345u;
+    return a->semilla >> 8;
+}
+
+// Una REQ o QUERY para su parque o, con -x, para otro.
+static int armar_solicitud(AgenteCarga *a, char *linea, size_t tam) {
+    unsigned r = siguiente_azar(a);
+    int parque = a->parque;
+    if (cfg.parques > 1 && (int)(r % 100) < cfg.pctOtroParque) {
+        parque = (parque + 1 + (int)((r / 100) % (unsigned)(cfg.parques - 1))) % cfg.parques;
+    }
+    if ((int)((r / 7) % 100) < cfg.pctConsultas) {
+        return snprintf(linea, tam, "QUERY|%s|7|19|%u|%ld|%s\n", a->nombre, 1 + r % 4,
+                        a->enviadas, idsParque[parque]);
+    }
+    return snprintf(linea, tam, "REQ|%s|f%ld|%u|%u|%ld|%s\n", a->nombre, a->enviadas,
+                    8 + r % 10, 1 + r % 4, a->enviadas, idsParque[parque]);
+}
+
+// Completa la ventana del agente. Por un socket cada linea es un paquete; por
+// el FIFO se juntan en escrituras de a lo sumo PIPE_BUF para que no se
+// intercalen con las de otros agentes.
+static int enviar_solicitudes(AgenteCarga *a) {
+    char lote[LOTE_FIFO];
+    size_t largo = 0;
+    while (a->enviadas < cfg.mensajes && a->enviadas - a->recibidas < cfg.ventana) {
+        char linea[256];
+        int n = armar_solicitud(a, linea, sizeof(linea));
+        if (cfg.transporte == TRANSPORTE_SOCKET) {
+            if (escribir_todo(a->fdEnvio, linea, (size_t)n) != 0) return -1;
+        } else {
+            if (largo + (size_t)n > sizeof(lote)) {
+                if (escribir_todo(a->fdEnvio, lote, largo) != 0) return -1;
+                largo = 0;
+            }
+            memcpy(lote + largo, linea, (size_t)n);
+            largo += (size_t)n;
+        }
+        a->enviadas++;
+    }
+    return largo > 0 ? escribir_todo(a->fdEnvio, lote, largo) : 0;
+}
+
+// Cuenta las lineas recibidas por su tipo; solo hacen falta sus primeros
+// caracteres (ENTER y EXIT no cuentan como respuesta).
+static int recibir(AgenteCarga *a) {
+    char buf[65536];
+    while (1) {
+        ssize_t n = read(a->fdRecibe, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        // Un FIFO sin escritor todavia da 0; en una sesion es que se cerro
+        if (n <= 0) return cfg.transporte == TRANSPORTE_FIFO && n == 0 ? 0 : -1;
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] != '\n') {
+                if (a->largoCabecera < (int)sizeof(a->cabecera)) {
+                    a->cabecera[a->largoCabecera++] = buf[i];
+                }
+                continue;
+            }
+            char c0 = a->largoCabecera > 0 ? a->cabecera[0] : '\0';
+            char c1 = a->largoCabecera > 1 ? a->cabecera[1] : '\0';
+            if (c0 == 'R' || c0 == 'D') {
+                a->recibidas++;
+            } else if (c0 == 'T') {
+                a->registrado = 1;
+            } else if (c0 == 'E' && (c1 == 'R' || (c1 == 'N' && a->largoCabecera > 2 &&
+                                                   a->cabecera[2] == 'D'))) {
+                a->fallo = 1;
+            }
+            a->largoCabecera = 0;
+        }
+        if (cfg.transporte == TRANSPORTE_SOCKET) return 0;
+    }
+}
+
+// Atiende a sus agentes hasta que todos tengan la condicion: registrados
+// (fase 0) o con todas sus respuestas (fase 1).
+static int atender_agentes(HiloCarga *h, int fase) {
+    struct pollfd *pfds = calloc((size_t)h->num, sizeof(*pfds));
+    int *idx = calloc((size_t)h->num, sizeof(*idx));
+    if (!pfds || !idx) {
+        free(pfds);
+        free(idx);
+        return -1;
+    }
+    struct timespec t0, t;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int error = 0;
+    while (!error) {
+        int n = 0;
+        for (int i = 0; i < h->num; ++i) {
+            AgenteCarga *a = &h->agentes[i];
+            if (a->fallo) {
+                error = 1;
+                break;
+            }
+            if (fase == 0 ? a->registrado : a->recibidas == cfg.mensajes) continue;
+            if (fase == 1 && enviar_solicitudes(a) != 0) {
+                error = 1;
+                break;
+            }
+            pfds[n].fd = a->fdRecibe;
+            pfds[n].events = POLLIN;
+            idx[n++] = i;
+        }
+        if (error || n == 0) break;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if (ms_entre(&t0, &t) > PLAZO_MS) {
+            fprintf(stderr, "%d agente(s) sin completar tras %d ms.\n", n, PLAZO_MS);
+            error = 1;
+            break;
+        }
+        if (poll(pfds, (nfds_t)n, 1000) == -1 && errno != EINTR) {
+            perror("poll");
+            error = 1;
+            break;
+        }
+        for (int k = 0; k < n; ++k) {
+            if (pfds[k].revents && recibir(&h->agentes[idx[k]]) != 0) {
+                error = 1;
+            }
+        }
+    }
+    free(pfds);
+    free(idx);
+    return error ? -1 : 0;
+}
+
+static void *hilo_carga(void *arg) {
+    HiloCarga *h = (HiloCarga *)arg;
+    h->error = atender_agentes(h, 0) != 0;
+    pthread_barrier_wait(&barrera);
+    if (!h->error) h->error = atender_agentes(h, 1) != 0;
+    return NULL;
+}
+
+// Una medida con "fragmentos" fragmentos. Devuelve 0 si todos los agentes
+// recibieron todas sus respuestas.
+static int medir(int fragmentos) {
+    pid_t pid = lanzar_controlador(fragmentos);
+    if (pid == -1) return -1;
+
+    int error = esperar_controlador(pid);
+    AgenteCarga *agentes = calloc((size_t)cfg.agentes, sizeof(*agentes));
+    HiloCarga *hilos = calloc((size_t)cfg.hilos, sizeof(*hilos));
+    pthread_t *ids = calloc((size_t)cfg.hilos, sizeof(*ids));
+    if (!agentes || !hilos || !ids) {
+        perror("calloc");
+        error = -1;
+    }
+    int conectados = 0;
+    for (; error == 0 && conectados < cfg.agentes; ++conectados) {
+        if (conectar_agente(&agentes[conectados], conectados) != 0) error = -1;
+    }
+
+    struct timespec t0, t1;
+    int creados = 0;
+    if (error == 0) {
+        pthread_barrier_init(&barrera, NULL, (unsigned)cfg.hilos + 1);
+        int porHilo = cfg.agentes / cfg.hilos;
+        for (int k = 0; k < cfg.hilos; ++k) {
+            hilos[k].agentes = agentes + k * porHilo;
+            hilos[k].num = k == cfg.hilos - 1 ? cfg.agentes - k * porHilo : porHilo;
+            if (pthread_create(&ids[k], NULL, hilo_carga, &hilos[k]) != 0) {
+                // Sin todos los hilos la barrera nunca se completaria
+                perror("pthread_create");
+                exit(EXIT_FAILURE);
+            }
+            creados++;
+        }
+        pthread_barrier_wait(&barrera);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int k = 0; k < creados; ++k) {
+            pthread_join(ids[k], NULL);
+            if (hilos[k].error) error = -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        pthread_barrier_destroy(&barrera);
+    }
+
+    long total = 0;
+    for (int i = 0; i < conectados; ++i) {
+        total += agentes[i].recibidas;
+    }
+    if (error == 0) {
+        double ms = ms_entre(&t0, &t1);
+        printf("  -h %-3d %9.1f ms  %9.0f mensajes/s  (%ld respuestas)\n", fragmentos, ms,
+               ms > 0 ? total * 1000.0 / ms : 0.0, total);
+    } else {
+        fprintf(stderr, "  -h %d: la medida no se completo (%ld respuestas).\n", fragmentos,
+                total);
+    }
+    fflush(stdout);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    for (int i = 0; i < conectados; ++i) {
+        cerrar_agente(&agentes[i]);
+    }
+    for (int i = 0; i < cfg.parques; ++i) {
+        if (fdEntradaParque[i] > 0) close(fdEntradaParque[i]);
+        fdEntradaParque[i] = 0;
+    }
+    free(agentes);
+    free(hilos);
+    free(ids);
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Una sesion o FIFO por agente
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    snprintf(base, sizeof(base), "/tmp/bench_carga.%d", (int)getpid());
+    char ruta[96];
+    snprintf(ruta, sizeof(ruta), "%s.parques", base);
+    if (escribir_parques(ruta) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    printf("Parques=%d agentes=%d mensajes/agente=%d ventana=%d consultas=%d%% "
+           "otro parque=%d%% transporte=%s hilos=%d\n",
+           cfg.parques, cfg.agentes, cfg.mensajes, cfg.ventana, cfg.pctConsultas,
+           cfg.pctOtroParque, cfg.transporte == TRANSPORTE_SOCKET ? "socket" : "fifo", cfg.hilos);
+    int errores = 0;
+    for (int i = 0; i < cfg.numFragmentos; ++i) {
+        errores += medir(cfg.fragmentos[i]) != 0;
+    }
+
+    unlink(ruta);
+    snprintf(ruta, sizeof(ruta), "%s.in", base);
+    unlink(ruta);
+    for (int i = 0; i < cfg.parques; ++i) {
+        char fifo[128];
+        snprintf(fifo, sizeof(fifo), "%.63s.in.%.15s", base, idsParque[i]);
+        unlink(fifo);
+    }
+    snprintf(ruta, sizeof(ruta), "%s.sock", base);
+    unlink(ruta);
+    return errores ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ventana.h"
+
+// Microbenchmark de ventana_buscar: compara cada implementacion soportada con
+// la escalar sobre un calendario denso generado al azar (por defecto una
+// franja por minuto) y verifica que todas den el mismo resultado. Antes
+// comprueba casos fijos en los bordes de los bloques de 64 franjas, que al
+// azar casi nunca se dan.
+
+#define LLENO 100  // ocupacion de una franja sin lugar en los casos fijos
+#define LIBRE 0
+
+typedef struct {
+    int franjas;
+    int largo;
+    int consultas;
+    int aforo;
+    unsigned semilla;
+} ConfigBench;
+
+typedef struct {
+    int desde;
+    int32_t limite;
+} Consulta;
+
+// Caso fijo: calendario de "franjas" franjas llenas salvo los tramos libres
+// [libreIni, libreFin), y el resultado esperado de la busqueda.
+typedef struct {
+    const char *nombre;
+    int franjas;
+    int libres[2][2];
+    int desde;
+    int hasta;
+    int largo;
+    int esperado;
+} CasoFijo;
+
+static const CasoFijo casosFijos[] = {
+    {"cruza el borde 64", 200, {{60, 70}, {0, 0}}, 0, 200, 10, 60},
+    {"cruza el borde 128", 200, {{120, 136}, {0, 0}}, 0, 200, 16, 120},
+    {"desde dentro del tramo", 200, {{60, 70}, {0, 0}}, 65, 200, 5, 65},
+    {"largo > 64", 300, {{5, 71}, {100, 200}}, 0, 300, 90, 100},
+    {"largo justo del tramo", 300, {{5, 71}, {100, 200}}, 0, 300, 100, 100},
+    {"largo mayor que todo tramo", 300, {{5, 71}, {100, 200}}, 0, 300, 101, -1},
+    {"bloque final parcial", 160, {{140, 160}, {0, 0}}, 0, 150, 10, 140},
+    {"tramo cortado por hasta", 160, {{140, 160}, {0, 0}}, 0, 150, 11, -1},
+    {"hasta en el borde del bloque", 200, {{120, 140}, {0, 0}}, 0, 128, 8, 120},
+    {"desde == hasta", 200, {{0, 200}, {0, 0}}, 70, 70, 1, -1},
+    {"desde == hasta en borde", 200, {{0, 200}, {0, 0}}, 64, 64, 1, -1},
+    {"todo libre", 200, {{0, 200}, {0, 0}}, 3, 200, 197, 3},
+};
+
+// Prueba cada caso fijo con todas las implementaciones. Devuelve cuantos
+// casos fallaron en alguna.
+static int verificar_casos_fijos(const ImplementacionVentana *impl, int numImpl) {
+    int fallos = 0;
+    int numCasos = (int)(sizeof(casosFijos) / sizeof(casosFijos[0]));
+    for (int c = 0; c < numCasos; ++c) {
+        const CasoFijo *caso = &casosFijos[c];
+        int32_t *ocupacion = malloc((size_t)caso->franjas * sizeof(*ocupacion));
+        if (!ocupacion) {
+            perror("malloc");
+            return fallos + 1;
+        }
+        for (int i = 0; i < caso->franjas; ++i) ocupacion[i] = LLENO;
+        for (int t = 0; t < 2; ++t) {
+            for (int i = caso->libres[t][0]; i < caso->libres[t][1]; ++i) ocupacion[i] = LIBRE;
+        }
+        int correcto = 1;
+        for (int k = 0; k < numImpl; ++k) {
+            int r = impl[k].buscar(ocupacion, caso->desde, caso->hasta, caso->largo, LIBRE);
+            if (r != caso->esperado) {
+                fprintf(stderr, "Caso \"%s\": %s devolvio %d, se esperaba %d\n",
+                        caso->nombre, impl[k].nombre, r, caso->esperado);
+                correcto = 0;
+            }
+        }
+        fallos += !correcto;
+        free(ocupacion);
+    }
+    printf("Casos fijos: %d de %d correctos en todas las implementaciones\n",
+           numCasos - fallos, numCasos);
+    return fallos;
+}
+
+static void uso(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-n franjas] [-d largoVentana] [-q consultas] [-t aforo] [-x semilla]\n",
+            prog);
+}
+
+static int parse_args(int argc, char *argv[], ConfigBench *cfg) {
+    int opt;
+
+    cfg->franjas = 24 * 60;
+    cfg->largo = 120;
+    cfg->consultas = 200000;
+    cfg->aforo = 1000;
+    cfg->semilla = 1;
+
+    while ((opt = getopt(argc, argv, "n:d:q:t:x:")) != -1) {
+        switch (opt) {
+            case 'n':
+                cfg->franjas = atoi(optarg);
+                break;
+            case 'd':
+                cfg->largo = atoi(optarg);
+                break;
+            case 'q':
+                cfg->consultas = atoi(optarg);
+                break;
+            case 't':
+                cfg->aforo = atoi(optarg);
+                break;
+            case 'x':
+                cfg->semilla = (unsigned)atoi(optarg);
+                break;
+            default:
+                uso(argv[0]);
+                return -1;
+        }
+    }
+
+    if (cfg->franjas <= 0 || cfg->largo <= 0 || cfg->consultas <= 0 || cfg->aforo <= 0) {
+        uso(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static double ms_entre(const struct timespec *t0, const struct timespec *t1) {
+    return (t1->tv_sec - t0->tv_sec) * 1e3 + (t1->tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    ConfigBench cfg;
+    if (parse_args(argc, argv, &cfg) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    int32_t *ocupacion = malloc((size_t)cfg.franjas * sizeof(*ocupacion));
+    Consulta *consultas = malloc((size_t)cfg.consultas * sizeof(*consultas));
+    int *esperado = malloc((size_t)cfg.consultas * sizeof(*esperado));
+    if (!ocupacion || !consultas || !esperado) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    // Ocupacion alta con huecos ocasionales: la mayoria de las consultas
+    // recorren buena parte del calendario antes de encontrar lugar
+    srand(cfg.semilla);
+    for (int i = 0; i < cfg.franjas; ++i) {
+        ocupacion[i] = cfg.aforo - rand() % (cfg.aforo / 10 + 1);
+    }
+    for (int q = 0; q < cfg.consultas; ++q) {
+        consultas[q].desde = rand() % cfg.franjas;
+        consultas[q].limite = cfg.aforo - 1 - rand() % (cfg.aforo / 10 + 1);
+    }
+
+    const ImplementacionVentana *impl;
+    int numImpl = ventana_implementaciones(&impl);
+    printf("Franjas=%d largo=%d consultas=%d (elegida en esta CPU: %s)\n",
+           cfg.franjas, cfg.largo, cfg.consultas, ventana_iniciar());
+
+    double msEscalar = 0;
+    int errores = verificar_casos_fijos(impl, numImpl);
+    for (int k = 0; k < numImpl; ++k) {
+        long encontradas = 0;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int q = 0; q < cfg.consultas; ++q) {
+            int r = impl[k].buscar(ocupacion, consultas[q].desde, cfg.franjas, cfg.largo,
+                                   consultas[q].limite);
+            if (k == 0) {
+                esperado[q] = r;
+            } else if (r != esperado[q]) {
+                if (errores++ < 5) {
+                    fprintf(stderr, "%s difiere de escalar en la consulta %d: %d != %d\n",
+                            impl[k].nombre, q, r, esperado[q]);
+                }
+            }
+            encontradas += r != -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double ms = ms_entre(&t0, &t1);
+        if (k == 0) msEscalar = ms;
+        printf("  %-8s %9.2f ms  %7.1f ns/consulta  x%.2f  (%ld con lugar)\n",
+               impl[k].nombre, ms, ms * 1e6 / cfg.consultas,
+               ms > 0 ? msEscalar / ms : 0.0, encontradas);
+    }
+
+    free(ocupacion);
+    free(consultas);
+    free(esperado);
+    return errores ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -6,57 +7,418 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+
+#include "ocupacion.h"
+#include "ventana.h"
 
 #define MIN_HOUR 7
 #define MAX_HOUR 19
 #define MAX_NAME_LEN 64
 #define MAX_FAMILY_LEN 64
 #define MAX_LINE_LEN 256
-#define MAX_AGENTS 64
+#define MAX_CAMPOS 8                   // REQ y QUERY, las mas largas, tienen 7
+#define MAX_AGENTS 4096                // por fragmento
+#define MAX_CONEXIONES MAX_AGENTS
+#define TABLA_AGENTES (2 * MAX_AGENTS) // indice por nombre, potencia de 2
+
+// Cola de salida por agente
+#define COLA_SALIDA_MAX_DEF (64 * 1024) // limite por defecto en bytes (-q)
+#define MAX_DIFERIDAS 32                // REQ/QUERY retenidas por agente de una conexion suspendida
+#define MAX_RESPUESTA_LEN 768           // la mas larga es un DISP de todo el dia
+#define POLL_TIMEOUT_MS 100
+#define DRENADO_FIN_MS 5000             // espera maxima para entregar END al final
+#define BUF_ENTRADA (16 * MAX_LINE_LEN)
+#define TIPO_SOCKET SOCK_SEQPACKET
+#define MAX_PAQUETE_SOCKET 4096         // los agentes leen paquetes de hasta este tamano
+#define MAX_IOV_AVISOS 1024             // IOV_MAX en Linux
+#define MAX_AVISO_LEN (MAX_FAMILY_LEN + MAX_NAME_LEN + 48)
+
+// Parques (dominios de aforo independientes) y fragmentos que los atienden
+#define MAX_PARQUES 64
+#define MAX_PARQUE_LEN 32
+#define MAX_FRAGMENTOS MAX_PARQUES
+
+// Traza binaria de mensajes (-r graba, -R reproduce)
+#define TRAZA_MAGIC 0x5a415254u // "TRAZ"
+#define TRAZA_VERSION 4
+#define TRAZA_MAX_DATOS 65535   // "largo" es de 16 bits
 
 typedef struct Reservation {
     char family[MAX_FAMILY_LEN];
     int people;
     int startHour; // inclusiva
     int endHour;   // exclusiva (startHour + 2)
+    int fragmento; // fragmento del agente que la hizo
+    int agente;    // indice en los agentes de ese fragmento
 } Reservation;
 
+// Evento de entrada o salida. El aviso para el agente (ENTER/EXIT, con '\n')
+// se arma al aceptar la reserva para que en cada hora se envie sin copiarlo.
 typedef struct ResNode {
     Reservation res;
     struct ResNode *next;
+    size_t largoAviso;
+    char aviso[MAX_AVISO_LEN];
 } ResNode;
 
+// Bytes pendientes de escribir hacia un agente. Los datos validos estan en
+// datos[inicio .. inicio+len).
+typedef struct {
+    char *datos;
+    size_t inicio;
+    size_t len;
+    size_t cap;
+} ColaSalida;
+
+typedef enum {
+    CONEXION_ACTIVA = 0,
+    CONEXION_SUSPENDIDA,   // cola llena: las REQ y QUERY de sus agentes se retienen hasta que drene
+    CONEXION_DESCONECTADA  // cola llena con politica desconectar: solo recibe los END y
+                           // sus agentes deben re-registrarse
+} EstadoConexion;
+
+typedef enum {
+    POLITICA_SUSPENDER = 0,
+    POLITICA_DESCONECTAR
+} PoliticaLento;
+
+// Respuesta que llego antes que otra anterior de la misma conexion (la de una
+// REQ que contesta otro fragmento): espera su turno. Un aviso ENTER/EXIT que
+// llega mientras hay respuestas esperando sale despues de la de su turno.
+typedef struct {
+    uint32_t turno;
+    int esAviso;
+    char texto[MAX_RESPUESTA_LEN];
+} RespuestaRetenida;
+
+// Texto para stdout que acumula un solo hilo y escribe con un write, sin
+// pasar por el FILE de stdout (y su lock, compartido por todos los hilos).
+typedef struct {
+    char *datos;
+    size_t len;
+    size_t cap;
+} BufferTexto;
+
+// Lineas recibidas aun sin '\n' final (read puede cortar un mensaje)
+typedef struct {
+    char datos[BUF_ENTRADA];
+    size_t len;
+} BufferEntrada;
+
+typedef enum {
+    CONEXION_FIFO = 0,   // respuestas por el FIFO que el agente indico en REG
+    CONEXION_SOCKET      // sesion Unix: entrada y respuestas por el mismo socket
+} TipoConexion;
+
+// Canal de respuesta hacia uno o varios agentes. Un proceso que multiplexa
+// muchos agentes logicos los registra a todos con el mismo FIFO (o socket);
+// comparten esta cola para que sus lineas nunca se intercalen.
+typedef struct {
+    int enUso;
+    TipoConexion tipo;
+    char fifoPath[128];     // solo CONEXION_FIFO
+    int fd;                 // O_NONBLOCK; en FIFO -1 si no hay lector aun
+    BufferEntrada *entrada; // solo CONEXION_SOCKET
+    ColaSalida cola;
+    EstadoConexion estado;
+    int numAgentes;         // agentes registrados por esta conexion
+    char (*diferidas)[MAX_LINE_LEN];
+    int numDiferidas;
+    int capDiferidas;
+    struct iovec *avisos;   // avisos ENTER/EXIT de la hora que se esta enviando
+    int numAvisos;
+    int capAvisos;
+    // Cada REG, REQ y QUERY toma un turno y sus respuestas se encolan en ese
+    // orden aunque alguna la conteste otro fragmento
+    uint32_t generacion;    // cambia al reutilizarse: descarta respuestas viejas
+    uint32_t turnoAsignado;
+    uint32_t turnoEnviado;
+    uint32_t turnoVigente;  // primer turno tras re-registrarse desconectada: las
+                            // respuestas anteriores ya no corresponden
+    RespuestaRetenida *retenidas;
+    int numRetenidas;
+    int capRetenidas;
+} Conexion;
+
 typedef struct {
     char name[MAX_NAME_LEN];
-    char fifoPath[128];
+    int conexion;           // indice en las conexiones del fragmento, -1 si su sesion se cerro
+    struct Parque *parque;  // el nombrado en REG: su hora va en TIME y es el de
+                            // sus REQ/QUERY sin campo de parque
 } AgentInfo;
 
+// Formato de la traza: cada fragmento graba la suya. Una cabecera con la tabla
+// de parques y luego, en orden de llegada, un registro por cada entrada no
+// determinista del fragmento: lo leido de sus FIFOs de entrada o de sus
+// sesiones (seguido de "largo" bytes tal como llegaron), cada hora de sus
+// parques, la apertura y cierre de sesiones, cuanto admitio cada escritura
+// hacia un agente, y lo que le llego de otros fragmentos (REQ para sus
+// parques, respuestas y avisos para sus agentes, y la ocupacion publicada de
+// un parque ajeno cuando la leyo). Con eso la reproduccion vuelve a pasar por
+// el mismo codigo (procesar_buffer_entrada y manejar_linea_mensaje) y repite
+// tambien las decisiones de agente lento, que dependen de cuanto consumieron
+// los agentes y no solo de lo que enviaron.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t limiteCola;
+    int32_t politica;
+    int32_t fragmento;      // el que grabo esta traza
+    int32_t numFragmentos;
+    int32_t numParques;     // siguen numParques ParqueTraza
+} CabeceraTraza;
+
+typedef struct {
+    char id[MAX_PARQUE_LEN];
+    int32_t horaIni;
+    int32_t horaFin;
+    int32_t segHoras;
+    int32_t aforo;
+    int32_t fragmento;
+} ParqueTraza;
+
+typedef enum {
+    TRAZA_LECTURA = 1,    // datos leidos del k-esimo FIFO de entrada (conexion -1-k) o de una sesion
+    TRAZA_HORA,           // el parque "conexion" avanzo a la hora "valor"
+    TRAZA_SESION_ABRE,    // se acepto una sesion, que ocupo la conexion indicada
+    TRAZA_SESION_CIERRA,  // el agente cerro la sesion
+    TRAZA_ESCRITURA,      // el FIFO o socket admitio "valor" bytes de la cola o de los avisos
+    TRAZA_ESCRITURA_FIN,  // idem, y luego la escritura fallo y la sesion se cerro
+    TRAZA_REANUDA,        // una conexion suspendida volvio a admitir solicitudes
+    TRAZA_AVISOS,         // se enviaron los avisos ENTER/EXIT pendientes de sus parques
+    TRAZA_SOLICITUD,      // REQ de otro fragmento para un parque propio: DatosSolicitud y la linea
+    TRAZA_RESPUESTA,      // respuesta de otro fragmento para la conexion indicada, turno en
+                          // "valor": generacion (uint32_t) y el texto
+    TRAZA_AVISOS_REMOTOS, // avisos de otro fragmento: por aviso, agente (int32_t), largo
+                          // (uint16_t) y el texto
+    TRAZA_OCUPACION,      // copia publicada del parque "conexion", de otro fragmento
+    TRAZA_FIN             // termino la simulacion y se envian los END
+} TipoRegistroTraza;
+
+typedef struct {
+    uint32_t secuencia; // orden de llegada
+    int32_t conexion;   // indice en las conexiones del fragmento (o parque/FIFO segun el tipo)
+    uint32_t valor;
+    uint16_t largo;     // bytes de datos que siguen al registro
+    uint8_t tipo;
+    uint8_t hora;       // hora simulada del primer parque del fragmento al ocurrir
+} RegistroTraza;
+
+typedef struct {
+    int32_t parque;
+    int32_t origen;
+    int32_t agente;
+    int32_t rechazada;
+} DatosSolicitud;
+
+// REQ en camino al fragmento que atiende su parque (o ya en el, si es el
+// mismo). Lleva lo que ese fragmento necesita para contestarla: nunca lee las
+// tablas de agentes ni de conexiones de otro fragmento.
+typedef struct {
+    int parque;                 // indice en parques[]
+    int origen;                 // fragmento de la conexion del agente
+    int agente;                 // indice en los agentes de ese fragmento
+    int conexion;               // a donde va la respuesta, y en que turno
+    uint32_t generacion;
+    uint32_t turno;
+    int rechazada;              // no cupo entre las diferidas: se niega sin admision
+    char linea[MAX_LINE_LEN];   // tal como llego
+} Solicitud;
+
+// Respuesta ya formateada que el fragmento del agente encola en su turno.
+typedef struct {
+    int conexion;
+    uint32_t generacion;
+    uint32_t turno;
+    char texto[MAX_RESPUESTA_LEN];
+} Respuesta;
+
+typedef enum {
+    MENSAJE_SOLICITUD = 0, // REQ para un parque del fragmento destino
+    MENSAJE_RESPUESTA,     // su respuesta, para una conexion del fragmento destino
+    MENSAJE_AVISOS         // ENTER/EXIT para agentes del fragmento destino
+} TipoMensaje;
+
+typedef struct {
+    TipoMensaje tipo;
+    union {
+        Solicitud solicitud;
+        Respuesta respuesta;
+        struct {
+            const ResNode **nodos; // el arreglo es del mensaje; los ResNode, del parque
+            int numNodos;
+        } avisos;
+    };
+} Mensaje;
+
+// Mensajes de una vuelta hacia un fragmento, o su bandeja de entrada.
+typedef struct {
+    Mensaje *mensajes;
+    int num;
+    int cap;
+} LoteMensajes;
+
+// Avisos de los parques propios para agentes de otro fragmento, hasta el
+// final de la vuelta.
+typedef struct {
+    const ResNode **nodos;
+    int num;
+    int cap;
+} AvisosRemotos;
+
+// Avisos ENTER/EXIT aun no enviados. Las listas solo crecen por la cabeza,
+// asi que desde las cabezas guardadas se recorren exactamente los eventos
+// impresos en esa hora. Las entradas van desde entradas hasta finEntradas
+// (NULL en los avisos de una hora completa).
+typedef struct {
+    ResNode *salidas;
+    ResNode *entradas;
+    ResNode *finEntradas;
+} AvisosHora;
+
+// FIFO de entrada que atiende un fragmento
+typedef struct {
+    char ruta[160];
+    int fd;
+    int fdDummy;            // escritura propia para que read no devuelva EOF
+    BufferEntrada buf;
+} EntradaFifo;
+
+struct Fragmento;
+
+// Dominio de aforo independiente: sus horas, su aforo y todo su estado. Solo
+// lo modifica el hilo del fragmento al que pertenece; los demas lo leen a
+// traves de la copia publicada con seqlock (TIME y QUERY de sus agentes).
+// Alineado a linea de cache para que dos parques de fragmentos distintos no
+// compartan lineas.
+typedef struct Parque {
+    char id[MAX_PARQUE_LEN];          // "" en el parque unico sin -k
+    char prefijo[MAX_PARQUE_LEN + 4]; // "[id] " delante de su salida, "" sin -k
+    int indice;                       // en parques[]
+    int horaIni;
+    int horaFin;
+    int segHoras;
+    int aforo;
+
+    int horaActual;
+    int terminado;
+    struct timespec proximaHora;      // CLOCK_MONOTONIC
+
+    // EstadaAsticas
+    int personasPorHora[24 + 1]; // aAndice 1-24, usamos 7-19
+    int solicitudesNegadas;
+    int solicitudesAceptadasExactas;
+    int solicitudesReprogramadas;
+
+    // Eventos de entrada/salida por hora
+    ResNode *entradasPorHora[24 + 3]; // un poco maes para salidas hasta hora+2
+    ResNode *salidasPorHora[24 + 3];
+    int personasEntranPorHora[24 + 3];
+    int personasSalenPorHora[24 + 3];
+
+    // Cada hora puede dejar sus avisos y los ENTER tardios de la anterior
+    AvisosHora horasPorAvisar[2 * (24 + 1)];
+    int numHorasPorAvisar;
+    ResNode *entradasAvisadas; // cabeza de entradasPorHora[horaActual] ya avisada
+
+    // Ocupacion publicada con seqlock. Con -m vive en un archivo para
+    // lectores externos; sin -m en memoria anonima.
+    ArchivoOcupacion *ocupacion;
+
+    struct Fragmento *fragmento;
+} __attribute__((aligned(64))) Parque;
+
+// Hilo que atiende un subconjunto de los parques y a los agentes que llegan
+// por sus FIFOs de entrada o por las sesiones que acepta. Tiene sus propias
+// tablas de agentes y conexiones, su salida y su traza; con otros fragmentos
+// solo comparte la bandeja de entrada, donde le dejan REQ para sus parques y
+// respuestas y avisos para sus agentes.
+typedef struct Fragmento {
+    int id;
+    pthread_t hilo;
+    Parque *parques[MAX_PARQUES];
+    int numParques;
+    int activo;             // en reproduccion, solo los que tienen traza
+
+    // Bandeja de entrada (mutexBandeja) y pipe para despertarlo
+    pthread_mutex_t mutexBandeja;
+    LoteMensajes bandeja;
+    int pipeDespertar[2];
+
+    // Desde aqui solo lo usa el hilo del fragmento
+    EntradaFifo *entradas;
+    int numEntradas;
+    AgentInfo *agentes;
+    int numAgentes;
+    int *indiceAgentes;     // posicion en agentes + 1, 0 = libre
+    Conexion *conexiones;
+    int numConexiones;      // espacios usados alguna vez
+    int *tocadas;           // conexiones con avisos en el envio en curso
+    struct pollfd *pfds;
+    int *idxPoll;
+    LoteMensajes hacia[MAX_FRAGMENTOS]; // mensajes de esta vuelta para cada fragmento
+    AvisosRemotos avisosHacia[MAX_FRAGMENTOS];
+    LoteMensajes enProceso;             // bandeja que se esta atendiendo
+    BufferTexto texto;
+    int cerrando;           // terminaron todos los parques: ya no lee entradas
+
+    // Traza en grabacion (NULL si no se uso -r)
+    FILE *trazaSalida;
+    uint32_t secuenciaTraza;
+    // Traza que se reproduce (-R)
+    FILE *trazaEntrada;
+    RegistroTraza registroDevuelto;
+    int hayRegistroDevuelto;
+    int trazaInconsistente;
+    char *datosTraza;       // TRAZA_MAX_DATOS
+    long mensajes;          // lineas y mensajes atendidos (-R)
+    int errorReproduccion;
+} __attribute__((aligned(64))) Fragmento;
+
 // Estado global de la simulaciaIn
 static int horaIni = 7;
 static int horaFin = 19;
 static int segHoras = 1;
 static int aforoMaximo = 0;
 static char pipeRecibePath[128] = {0};
-
-static int horaActual = 7;
-static int simulacionTerminada = 0;
-
-// EstadaAsticas
-static int personasPorHora[24 + 1]; // aAndice 1-24, usamos 7-19
-static int solicitudesNegadas = 0;
-static int solicitudesAceptadasExactas = 0;
-static int solicitudesReprogramadas = 0;
-
-// Eventos de entrada/salida por hora
-static ResNode *entradasPorHora[24 + 3]; // un poco maes para salidas hasta hora+2
-static ResNode *salidasPorHora[24 + 3];
-
-// Agentes registrados
-static AgentInfo agentes[MAX_AGENTS];
-static int numAgentes = 0;
-
-// SincronizaciaIn
-static pthread_mutex_t mutexDatos = PTHREAD_MUTEX_INITIALIZER;
+static char socketPath[108] = {0};
+static size_t limiteColaSalida = COLA_SALIDA_MAX_DEF;
+static PoliticaLento politicaLento = POLITICA_SUSPENDER;
+static char archivoOcupacionPath[128] = {0};
+static char trazaGrabarPath[128] = {0};
+static char trazasReproducir[MAX_FRAGMENTOS][128]; // -R, una por fragmento
+static int numTrazasReproducir = 0;
+static char archivoParquesPath[128] = {0};
+static int fragmentosPedidos = 0; // -h, 0 = uno por CPU hasta uno por parque
+
+// Parques y fragmentos. Sin -k hay un unico parque con -i/-f/-s/-t.
+static Parque parques[MAX_PARQUES];
+static int numParques = 0;
+static Fragmento fragmentos[MAX_FRAGMENTOS];
+static int numFragmentos = 0;
+
+// Lo comparten todos los fragmentos: cada uno acepta las sesiones que le
+// toquen y se queda con ellas.
+static int fdEscucha = -1;
+
+// Fin de la simulacion. Un fragmento deja de leer sus entradas cuando
+// terminaron todos los parques, y sale cuando todos dejaron de leer y no
+// queda ninguna REQ reenviada sin respuesta.
+static atomic_int parquesTerminados;
+static atomic_int fragmentosCerrando;
+static atomic_int turnosEnVuelo;
+
+// En reproduccion (-R) no hay FIFOs ni sockets: lo leido y lo escrito salen
+// de la traza, y lo que se enviaria a otros fragmentos se descarta.
+static int reproduciendo = 0;
 
 // ---------------------------------------------------------------------------
 // Utilidades
@@ -70,7 +432,90 @@ static void trim_newline(char *s) {
     }
 }
 
-static void agregar_reserva_eventos(const Reservation *r) {
+// Parte la linea en sus campos separados por '|' sin saltarse los vacios
+// (strtok los colapsa), asi "REQ|a|f|7|2||sur" deja el id vacio y el parque
+// en su lugar. Devuelve cuantos campos dejo en campos[].
+static int separar_campos(char *linea, char **campos, int max) {
+    int n = 0;
+    while (n < max) {
+        campos[n++] = linea;
+        char *sep = strchr(linea, '|');
+        if (!sep) break;
+        *sep = '\0';
+        linea = sep + 1;
+    }
+    return n;
+}
+
+// Campo opcional: ausente o vacio cuentan igual.
+static const char *campo_opcional(char **campos, int n, int i) {
+    return i < n && campos[i][0] != '\0' ? campos[i] : NULL;
+}
+
+static int texto_reservar(BufferTexto *b, size_t extra) {
+    if (b->len + extra <= b->cap) return 0;
+    size_t nueva = b->cap ? b->cap : 4096;
+    while (nueva < b->len + extra) nueva *= 2;
+    char *d = realloc(b->datos, nueva);
+    if (!d) {
+        perror("realloc salida");
+        return -1;
+    }
+    b->datos = d;
+    b->cap = nueva;
+    return 0;
+}
+
+static void texto_printf(BufferTexto *b, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void texto_printf(BufferTexto *b, const char *fmt, ...) {
+    if (texto_reservar(b, 256) != 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->datos + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= b->cap - b->len) {
+        if (texto_reservar(b, (size_t)n + 1) != 0) return;
+        va_start(ap, fmt);
+        vsnprintf(b->datos + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += (size_t)n;
+}
+
+// Escribe lo acumulado en stdout. Siempre son lineas completas: la salida de
+// hilos distintos se intercala por bloques de lineas.
+static void volcar_texto(BufferTexto *b) {
+    size_t hecho = 0;
+    while (hecho < b->len) {
+        ssize_t w = write(STDOUT_FILENO, b->datos + hecho, b->len - hecho);
+        if (w == -1 && errno == EINTR) continue;
+        if (w <= 0) break;
+        hecho += (size_t)w;
+    }
+    b->len = 0;
+}
+
+static void *crecer(void *datos, int *cap, size_t tamElem) {
+    int nueva = *cap ? *cap * 2 : 64;
+    void *d = realloc(datos, (size_t)nueva * tamElem);
+    if (!d) {
+        perror("realloc");
+        return NULL;
+    }
+    *cap = nueva;
+    return d;
+}
+
+static void armar_aviso(ResNode *n, const char *tipo, int hora, const char *nombreAgente) {
+    int largo = snprintf(n->aviso, sizeof(n->aviso), "%s|%s|%d|%d|%s\n", tipo,
+                         n->res.family, hora, n->res.people, nombreAgente);
+    n->largoAviso = (size_t)largo < sizeof(n->aviso) ? (size_t)largo : sizeof(n->aviso) - 1;
+}
+
+static void agregar_reserva_eventos(Parque *p, const Reservation *r, const char *nombreAgente) {
     ResNode *nEntrada = (ResNode *)malloc(sizeof(ResNode));
     ResNode *nSalida = (ResNode *)malloc(sizeof(ResNode));
     if (!nEntrada || !nSalida) {
@@ -80,451 +525,2819 @@ static void agregar_reserva_eventos(const Reservation *r) {
         return;
     }
     nEntrada->res = *r;
-    nEntrada->next = entradasPorHora[r->startHour];
-    entradasPorHora[r->startHour] = nEntrada;
+    armar_aviso(nEntrada, "ENTER", r->startHour, nombreAgente);
+    nEntrada->next = p->entradasPorHora[r->startHour];
+    p->entradasPorHora[r->startHour] = nEntrada;
 
     nSalida->res = *r;
-    nSalida->next = salidasPorHora[r->endHour];
-    salidasPorHora[r->endHour] = nSalida;
+    armar_aviso(nSalida, "EXIT", r->endHour, nombreAgente);
+    nSalida->next = p->salidasPorHora[r->endHour];
+    p->salidasPorHora[r->endHour] = nSalida;
+
+    p->personasEntranPorHora[r->startHour] += r->people;
+    p->personasSalenPorHora[r->endHour] += r->people;
 }
 
-static AgentInfo *buscar_agente(const char *nombre) {
-    for (int i = 0; i < numAgentes; ++i) {
-        if (strcmp(agentes[i].name, nombre) == 0) {
-            return &agentes[i];
-        }
+// Con varios parques cada uno usa su propio archivo (-m) y FIFO de entrada: ruta.id
+static void ruta_de_parque(char *dst, size_t tam, const char *ruta, const Parque *p) {
+    if (p->id[0] == '\0') {
+        snprintf(dst, tam, "%s", ruta);
+    } else {
+        snprintf(dst, tam, "%.127s.%.31s", ruta, p->id);
     }
-    return NULL;
 }
 
-static AgentInfo *registrar_agente(const char *nombre, const char *fifoPath) {
-    AgentInfo *a = buscar_agente(nombre);
-    if (a) {
-        // Actualizar ruta en caso de que cambie
-        strncpy(a->fifoPath, fifoPath, sizeof(a->fifoPath) - 1);
-        a->fifoPath[sizeof(a->fifoPath) - 1] = '\0';
-        return a;
+// ---------------------------------------------------------------------------
+// Publicacion de ocupacion
+//
+// Cada parque tiene su copia y solo la escribe el hilo de su fragmento, por
+// lo que hay un unico escritor por seqlock. Ver ocupacion.h para el protocolo
+// de lectura.
+// ---------------------------------------------------------------------------
+
+// ruta NULL: la copia solo se usa dentro del proceso (TIME y QUERY).
+static int crear_archivo_ocupacion(Parque *p, const char *ruta) {
+    void *m;
+    if (ruta) {
+        int fd = open(ruta, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror("open archivo de ocupacion");
+            return -1;
+        }
+        if (ftruncate(fd, (off_t)sizeof(ArchivoOcupacion)) == -1) {
+            perror("ftruncate archivo de ocupacion");
+            close(fd);
+            return -1;
+        }
+        m = mmap(NULL, sizeof(ArchivoOcupacion), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        m = mmap(NULL, sizeof(ArchivoOcupacion), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     }
-    if (numAgentes >= MAX_AGENTS) {
-        fprintf(stderr, "Se alcanzaI el maeximo de agentes registrados.\n");
-        return NULL;
+    if (m == MAP_FAILED) {
+        perror("mmap archivo de ocupacion");
+        return -1;
     }
-    AgentInfo *nuevo = &agentes[numAgentes++];
-    strncpy(nuevo->name, nombre, sizeof(nuevo->name) - 1);
-    nuevo->name[sizeof(nuevo->name) - 1] = '\0';
-    strncpy(nuevo->fifoPath, fifoPath, sizeof(nuevo->fifoPath) - 1);
-    nuevo->fifoPath[sizeof(nuevo->fifoPath) - 1] = '\0';
-    return nuevo;
+
+    ArchivoOcupacion *a = (ArchivoOcupacion *)m;
+    a->version = OCUPACION_VERSION;
+    a->tamano = (uint32_t)sizeof(ArchivoOcupacion);
+    a->horaIni = p->horaIni;
+    a->horaFin = p->horaFin;
+    a->aforo = p->aforo;
+    atomic_store_explicit(&a->secuencia, 0, memory_order_relaxed);
+    atomic_store_explicit(&a->numTicks, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    // El magic va al final: un lector que lo ve encuentra la cabecera completa
+    a->magic = OCUPACION_MAGIC;
+
+    p->ocupacion = a;
+    return 0;
 }
 
-static void enviar_mensaje_agente(const AgentInfo *ag, const char *mensaje) {
-    if (!ag || !mensaje) return;
-    int fd = open(ag->fifoPath, O_WRONLY | O_NONBLOCK);
-    if (fd == -1) {
-        fprintf(stderr, "No se pudo abrir FIFO de agente %s (%s): %s\n",
-                ag->name, ag->fifoPath, strerror(errno));
-        return;
+static void publicar_ocupacion(Parque *p) {
+    ArchivoOcupacion *a = p->ocupacion;
+    if (!a) return;
+
+    ocupacion_escribir_inicio(a);
+    EstadoOcupacion *e = &a->actual;
+    e->horaActual = p->horaActual;
+    e->terminada = p->terminado;
+    for (int h = 0; h < OCUPACION_HORAS; ++h) {
+        e->personasPorHora[h] = p->personasPorHora[h];
+        e->entranPorHora[h] = p->personasEntranPorHora[h];
+        e->salenPorHora[h] = p->personasSalenPorHora[h];
     }
-    write(fd, mensaje, strlen(mensaje));
-    write(fd, "\n", 1);
-    close(fd);
+    e->negadas = p->solicitudesNegadas;
+    e->aceptadasExactas = p->solicitudesAceptadasExactas;
+    e->reprogramadas = p->solicitudesReprogramadas;
+    ocupacion_escribir_fin(a);
+}
+
+// Agrega al historial el estado de la hora que acaba de comenzar.
+static void publicar_tick(Parque *p, int hora) {
+    ArchivoOcupacion *a = p->ocupacion;
+    if (!a) return;
+
+    uint32_t n = atomic_load_explicit(&a->numTicks, memory_order_relaxed);
+    if (n < OCUPACION_MAX_TICKS) {
+        RegistroTick *t = &a->historial[n];
+        t->hora = hora;
+        t->ocupacion = p->personasPorHora[hora];
+        t->entran = p->personasEntranPorHora[hora];
+        t->salen = p->personasSalenPorHora[hora];
+        t->negadas = p->solicitudesNegadas;
+        t->aceptadasExactas = p->solicitudesAceptadasExactas;
+        t->reprogramadas = p->solicitudesReprogramadas;
+        atomic_store_explicit(&a->numTicks, n + 1, memory_order_release);
+    }
+    publicar_ocupacion(p);
 }
 
 // ---------------------------------------------------------------------------
-// LaIgica de reservas
+// Traza de la ejecucion (-r)
+//
+// La escribe cada fragmento desde su punto de entrada (lectura, aceptacion de
+// sesiones, escrituras, reloj de sus parques y bandeja), y el efecto de cada
+// registro se aplica enseguida en el mismo hilo: el orden de la traza es el
+// orden real en que el fragmento vio cada entrada.
 // ---------------------------------------------------------------------------
 
-static int hay_cupo_bloque(int horaInicio, int personas) {
-    int h1 = horaInicio;
-    int h2 = horaInicio + 1;
-    if (h1 < MIN_HOUR || h2 > MAX_HOUR) return 0;
-    if (personasPorHora[h1] + personas > aforoMaximo) return 0;
-    if (personasPorHora[h2] + personas > aforoMaximo) return 0;
-    return 1;
+static int crear_traza(Fragmento *f, const char *ruta) {
+    f->trazaSalida = fopen(ruta, "wb");
+    if (!f->trazaSalida) {
+        perror("fopen traza");
+        return -1;
+    }
+    setvbuf(f->trazaSalida, NULL, _IOFBF, 64 * 1024);
+    CabeceraTraza cab = {TRAZA_MAGIC, TRAZA_VERSION, (uint32_t)limiteColaSalida,
+                         (int32_t)politicaLento, f->id, numFragmentos, numParques};
+    int ok = fwrite(&cab, sizeof(cab), 1, f->trazaSalida) == 1;
+    for (int i = 0; ok && i < numParques; ++i) {
+        ParqueTraza pt;
+        memset(&pt, 0, sizeof(pt));
+        memcpy(pt.id, parques[i].id, sizeof(pt.id));
+        pt.horaIni = parques[i].horaIni;
+        pt.horaFin = parques[i].horaFin;
+        pt.segHoras = parques[i].segHoras;
+        pt.aforo = parques[i].aforo;
+        pt.fragmento = parques[i].fragmento->id;
+        ok = fwrite(&pt, sizeof(pt), 1, f->trazaSalida) == 1;
+    }
+    if (!ok) {
+        perror("fwrite traza");
+        fclose(f->trazaSalida);
+        f->trazaSalida = NULL;
+        return -1;
+    }
+    return 0;
 }
 
-// Devuelve horaInicio si encuentra espacio, -1 en caso contrario
-static int buscar_bloque_alternativo(int personas) {
-    for (int h = horaActual; h <= horaFin - 1; ++h) {
-        if (hay_cupo_bloque(h, personas)) {
-            return h;
-        }
+static void grabar_traza(Fragmento *f, TipoRegistroTraza tipo, int conexion, uint32_t valor,
+                         const void *datos, size_t largo) {
+    if (!f->trazaSalida) return;
+
+    RegistroTraza r;
+    r.secuencia = f->secuenciaTraza++;
+    r.conexion = conexion;
+    r.valor = valor;
+    r.largo = (uint16_t)largo;
+    r.tipo = (uint8_t)tipo;
+    r.hora = (uint8_t)f->parques[0]->horaActual;
+    if (fwrite(&r, sizeof(r), 1, f->trazaSalida) != 1 ||
+        (largo > 0 && fwrite(datos, 1, largo, f->trazaSalida) != largo)) {
+        perror("fwrite traza");
+        fclose(f->trazaSalida);
+        f->trazaSalida = NULL;
     }
-    return -1;
 }
 
-static void procesar_solicitud_reserva(const char *nombreAgente,
-                                       const char *familia,
-                                       int horaSolicitada,
-                                       int personas) {
-    pthread_mutex_lock(&mutexDatos);
-
-    AgentInfo *ag = buscar_agente(nombreAgente);
-    if (!ag) {
-        fprintf(stderr, "Solicitud de agente no registrado: %s\n", nombreAgente);
-        pthread_mutex_unlock(&mutexDatos);
-        return;
+// Siguiente registro de la traza en reproduccion; datos recibe "largo" bytes
+// (caben cap). Devuelve 1, 0 al final de la traza o -1 si esta cortada.
+static int leer_registro_traza(Fragmento *f, RegistroTraza *r, char *datos, size_t cap) {
+    if (f->hayRegistroDevuelto) {
+        *r = f->registroDevuelto;
+        f->hayRegistroDevuelto = 0;
+        return 1;
     }
-
-    printf("PeticiaIn recibida de agente=%s familia=%s hora=%d personas=%d\n",
-           nombreAgente, familia, horaSolicitada, personas);
-
-    char respuesta[256];
-
-    if (personas <= 0 || personas > aforoMaximo ||
-        horaSolicitada < MIN_HOUR || horaSolicitada > MAX_HOUR ||
-        horaSolicitada + 1 > horaFin) {
-        solicitudesNegadas++;
-        snprintf(respuesta, sizeof(respuesta),
-                 "RESP|NEG|%s|0|0", familia);
-        enviar_mensaje_agente(ag, respuesta);
-        pthread_mutex_unlock(&mutexDatos);
-        return;
+    if (fread(r, sizeof(*r), 1, f->trazaEntrada) != 1) {
+        return ferror(f->trazaEntrada) ? -1 : 0;
     }
-
-    int esExtemporanea = horaSolicitada < horaActual;
-
-    if (!esExtemporanea && hay_cupo_bloque(horaSolicitada, personas)) {
-        // Reserva en la hora solicitada
-        Reservation r;
-        strncpy(r.family, familia, sizeof(r.family) - 1);
-        r.family[sizeof(r.family) - 1] = '\0';
-        r.people = personas;
-        r.startHour = horaSolicitada;
-        r.endHour = horaSolicitada + 2;
-
-        personasPorHora[horaSolicitada] += personas;
-        personasPorHora[horaSolicitada + 1] += personas;
-        agregar_reserva_eventos(&r);
-
-        solicitudesAceptadasExactas++;
-        snprintf(respuesta, sizeof(respuesta),
-                 "RESP|OK|%s|%d|%d",
-                 familia, r.startHour, r.endHour);
-        enviar_mensaje_agente(ag, respuesta);
-        pthread_mutex_unlock(&mutexDatos);
-        return;
+    if ((r->largo > 0 && (!datos || r->largo > cap)) ||
+        fread(datos, 1, r->largo, f->trazaEntrada) != r->largo) {
+        return -1;
     }
+    return 1;
+}
 
-    // Buscar bloque alternativo (para extemporaeneas o sin cupo en la hora pedida)
-    int horaAlt = buscar_bloque_alternativo(personas);
-    if (horaAlt != -1) {
-        Reservation r;
-        strncpy(r.family, familia, sizeof(r.family) - 1);
-        r.family[sizeof(r.family) - 1] = '\0';
-        r.people = personas;
-        r.startHour = horaAlt;
-        r.endHour = horaAlt + 2;
-
-        personasPorHora[horaAlt] += personas;
-        personasPorHora[horaAlt + 1] += personas;
-        agregar_reserva_eventos(&r);
+// Solo para registros sin datos: vuelve a entregarse en la siguiente lectura.
+static void devolver_registro_traza(Fragmento *f, const RegistroTraza *r) {
+    f->registroDevuelto = *r;
+    f->hayRegistroDevuelto = 1;
+}
 
-        solicitudesReprogramadas++;
-        snprintf(respuesta, sizeof(respuesta),
-                 "RESP|REPROG|%s|%d|%d",
-                 familia, r.startHour, r.endHour);
-        enviar_mensaje_agente(ag, respuesta);
-        pthread_mutex_unlock(&mutexDatos);
-        return;
+static void marcar_traza_inconsistente(Fragmento *f, const char *esperado, int conexion) {
+    if (!f->trazaInconsistente) {
+        fprintf(stderr, "Traza inconsistente: se esperaba %s (%d).\n", esperado, conexion);
     }
+    f->trazaInconsistente = 1;
+}
 
-    // No se encontraI ningaUn bloque
-    solicitudesNegadas++;
-    if (esExtemporanea) {
-        snprintf(respuesta, sizeof(respuesta),
-                 "RESP|NEG_EXTEMP|%s|0|0", familia);
-    } else {
-        snprintf(respuesta, sizeof(respuesta),
-                 "RESP|NEG|%s|0|0", familia);
+static void cerrar_traza(Fragmento *f) {
+    if (!f->trazaSalida) return;
+    if (fclose(f->trazaSalida) != 0) {
+        perror("fclose traza");
     }
-    enviar_mensaje_agente(ag, respuesta);
-
-    pthread_mutex_unlock(&mutexDatos);
+    f->trazaSalida = NULL;
 }
 
-// ---------------------------------------------------------------------------
-// Hilo de reloj
-// ---------------------------------------------------------------------------
-
-static void imprimir_eventos_hora(int hora) {
-    ResNode *n;
-    int salen = 0;
-    int entran = 0;
-
-    n = salidasPorHora[hora];
-    while (n) {
-        printf("  Familia %s sale del parque (%d personas)\n",
-               n->res.family, n->res.people);
-        salen += n->res.people;
-        n = n->next;
+static unsigned hash_nombre(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
     }
+    return h;
+}
 
-    n = entradasPorHora[hora];
-    while (n) {
-        printf("  Familia %s entra al parque (%d personas)\n",
-               n->res.family, n->res.people);
-        entran += n->res.people;
-        n = n->next;
+static AgentInfo *buscar_agente(Fragmento *f, const char *nombre) {
+    unsigned i = hash_nombre(nombre) & (TABLA_AGENTES - 1);
+    while (f->indiceAgentes[i] != 0) {
+        AgentInfo *a = &f->agentes[f->indiceAgentes[i] - 1];
+        if (strcmp(a->name, nombre) == 0) {
+            return a;
+        }
+        i = (i + 1) & (TABLA_AGENTES - 1);
     }
+    return NULL;
+}
 
-    if (salen == 0 && entran == 0) {
-        printf("  No hay cambios de familias en esta hora.\n");
+static void indexar_agente(Fragmento *f, int pos) {
+    unsigned i = hash_nombre(f->agentes[pos].name) & (TABLA_AGENTES - 1);
+    while (f->indiceAgentes[i] != 0) {
+        i = (i + 1) & (TABLA_AGENTES - 1);
     }
+    f->indiceAgentes[i] = pos + 1;
 }
 
-static void *hilo_reloj(void *arg) {
-    (void)arg;
+static void descartar_cola(ColaSalida *c) {
+    c->inicio = 0;
+    c->len = 0;
+}
 
-    for (int h = horaIni + 1; h <= horaFin; ++h) {
-        sleep(segHoras);
-        pthread_mutex_lock(&mutexDatos);
-        horaActual = h;
-        printf("\n=== Ha transcurrido una hora, son las %d hr ===\n", horaActual);
-        imprimir_eventos_hora(horaActual);
-        pthread_mutex_unlock(&mutexDatos);
+static void cerrar_fd_conexion(Conexion *c) {
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
     }
-
-    pthread_mutex_lock(&mutexDatos);
-    simulacionTerminada = 1;
-    pthread_mutex_unlock(&mutexDatos);
-    return NULL;
 }
 
-// ---------------------------------------------------------------------------
-// Reporte final
-// ---------------------------------------------------------------------------
-
-static void imprimir_reporte_final(void) {
-    printf("\n===== REPORTE FINAL DEL CONTROLADOR =====\n");
+static int reservar_conexion(Fragmento *f) {
+    for (int i = 0; i < f->numConexiones; ++i) {
+        if (!f->conexiones[i].enUso) return i;
+    }
+    if (f->numConexiones >= MAX_CONEXIONES) {
+        fprintf(stderr, "Se alcanzo el maximo de conexiones de respuesta.\n");
+        return -1;
+    }
+    memset(&f->conexiones[f->numConexiones], 0, sizeof(f->conexiones[0]));
+    return f->numConexiones++;
+}
 
-    int maxPersonas = -1;
-    int minPersonas = 1e9;
+static void iniciar_conexion(Conexion *c, TipoConexion tipo, int fd) {
+    c->enUso = 1;
+    c->tipo = tipo;
+    c->fifoPath[0] = '\0';
+    c->fd = fd;
+    c->estado = CONEXION_ACTIVA;
+    c->numAgentes = 0;
+    c->numDiferidas = 0;
+    c->numAvisos = 0;
+    c->generacion++;
+    c->turnoAsignado = 0;
+    c->turnoEnviado = 0;
+    c->turnoVigente = 0;
+    c->numRetenidas = 0;
+    descartar_cola(&c->cola);
+    if (c->entrada) c->entrada->len = 0;
+}
 
-    for (int h = horaIni; h <= horaFin; ++h) {
-        if (personasPorHora[h] > maxPersonas) {
-            maxPersonas = personasPorHora[h];
-        }
-        if (personasPorHora[h] < minPersonas) {
-            minPersonas = personasPorHora[h];
+// Devuelve la conexion asociada al FIFO, creandola si no existe.
+static int obtener_conexion_fifo(Fragmento *f, const char *fifoPath) {
+    for (int i = 0; i < f->numConexiones; ++i) {
+        Conexion *c = &f->conexiones[i];
+        if (c->enUso && c->tipo == CONEXION_FIFO && strcmp(c->fifoPath, fifoPath) == 0) {
+            return i;
         }
     }
+    int libre = reservar_conexion(f);
+    if (libre == -1) return -1;
+    Conexion *c = &f->conexiones[libre];
+    iniciar_conexion(c, CONEXION_FIFO, -1);
+    strncpy(c->fifoPath, fifoPath, sizeof(c->fifoPath) - 1);
+    c->fifoPath[sizeof(c->fifoPath) - 1] = '\0';
+    return libre;
+}
 
-    printf("Horas pico (mayor ocupaciaIn = %d personas): ", maxPersonas);
-    for (int h = horaIni; h <= horaFin; ++h) {
-        if (personasPorHora[h] == maxPersonas) {
-            printf("%d ", h);
+// Alta de una sesion recien aceptada en el socket de escucha.
+static int abrir_sesion(Fragmento *f, int fd) {
+    int libre = reservar_conexion(f);
+    if (libre == -1) return -1;
+    Conexion *c = &f->conexiones[libre];
+    if (!c->entrada) {
+        c->entrada = malloc(sizeof(*c->entrada));
+        if (!c->entrada) {
+            perror("malloc entrada de sesion");
+            return -1;
         }
     }
-    printf("\n");
+    iniciar_conexion(c, CONEXION_SOCKET, fd);
+    return libre;
+}
 
-    printf("Horas de menor ocupaciaIn (=%d personas): ", minPersonas);
-    for (int h = horaIni; h <= horaFin; ++h) {
-        if (personasPorHora[h] == minPersonas) {
-            printf("%d ", h);
+// El agente cerro su socket (o se le desconecto por lento): sus agentes
+// quedan sin conexion hasta que se registren de nuevo. Lo que aun esta en
+// camino hacia la sesion se descarta al llegar (cambia la generacion al
+// reutilizarse).
+static void cerrar_sesion(Fragmento *f, int idx) {
+    Conexion *c = &f->conexiones[idx];
+    for (int i = 0; i < f->numAgentes; ++i) {
+        if (f->agentes[i].conexion == idx) {
+            f->agentes[i].conexion = -1;
         }
     }
-    printf("\n");
+    cerrar_fd_conexion(c);
+    descartar_cola(&c->cola);
+    c->numDiferidas = 0;
+    c->numRetenidas = 0;
+    c->enUso = 0;
+}
+
+static const char *describir_conexion(const Conexion *c) {
+    return c->tipo == CONEXION_FIFO ? c->fifoPath : "socket";
+}
+
+static Conexion *conexion_de(Fragmento *f, const AgentInfo *ag) {
+    return ag->conexion == -1 ? NULL : &f->conexiones[ag->conexion];
+}
 
-    printf("Solicitudes negadas: %d\n", solicitudesNegadas);
-    printf("Solicitudes aceptadas en su hora: %d\n", solicitudesAceptadasExactas);
-    printf("Solicitudes reprogramadas: %d\n", solicitudesReprogramadas);
+// Un agente deja de usar la conexion. Si era el ultimo FIFO, lo pendiente iba
+// dirigido a un proceso que ya no esta, asi que se descarta. Una sesion de
+// socket sigue abierta hasta que el agente la cierre.
+static void soltar_conexion(Fragmento *f, int idx) {
+    Conexion *c = &f->conexiones[idx];
+    if (--c->numAgentes > 0 || c->tipo == CONEXION_SOCKET) return;
+    cerrar_fd_conexion(c);
+    descartar_cola(&c->cola);
+    c->numDiferidas = 0;
+    c->numRetenidas = 0;
+    c->enUso = 0;
 }
 
-static void notificar_fin_a_agentes(void) {
-    for (int i = 0; i < numAgentes; ++i) {
-        enviar_mensaje_agente(&agentes[i], "END|FIN_SIMULACION");
+static AgentInfo *registrar_agente(Fragmento *f, const char *nombre, int idx) {
+    Conexion *c = &f->conexiones[idx];
+    AgentInfo *a = buscar_agente(f, nombre);
+    if (a) {
+        // Actualizar la conexion en caso de que cambie
+        if (a->conexion != idx) {
+            c->numAgentes++;
+            if (a->conexion != -1) soltar_conexion(f, a->conexion);
+            a->conexion = idx;
+        }
+        if (c->estado == CONEXION_DESCONECTADA) {
+            // Sus END|DESCONECTADO, si no salieron, ya no corresponden; tampoco
+            // las respuestas de REQ anteriores que aun esten en camino
+            descartar_cola(&c->cola);
+            c->estado = CONEXION_ACTIVA;
+            c->turnoVigente = c->turnoAsignado;
+        }
+        return a;
+    }
+    if (f->numAgentes >= MAX_AGENTS) {
+        fprintf(stderr, "Se alcanzaI el maeximo de agentes registrados.\n");
+        return NULL;
     }
+    AgentInfo *nuevo = &f->agentes[f->numAgentes];
+    strncpy(nuevo->name, nombre, sizeof(nuevo->name) - 1);
+    nuevo->name[sizeof(nuevo->name) - 1] = '\0';
+    nuevo->conexion = idx;
+    nuevo->parque = &parques[0];
+    c->numAgentes++;
+    indexar_agente(f, f->numAgentes);
+    f->numAgentes++;
+    return nuevo;
 }
 
 // ---------------------------------------------------------------------------
-// Parseo de argumentos
+// Envio hacia agentes
+//
+// Los mensajes nunca se escriben directamente: se agregan a la cola de salida
+// de la conexion del agente y el fragmento la vacia cuando el FIFO o socket
+// admite escritura. Asi un agente lento no bloquea la admision ni pierde
+// respuestas; si la cola supera limiteColaSalida se aplica politicaLento.
 // ---------------------------------------------------------------------------
 
-static void uso(const char *prog) {
-    fprintf(stderr,
-            "Uso: %s -i horaIni -f horaFin -s segHoras -t total -p pipeRecibe\n",
-            prog);
+static int cola_reservar(ColaSalida *c, size_t extra) {
+    if (c->inicio > 0 && c->inicio + c->len + extra > c->cap) {
+        memmove(c->datos, c->datos + c->inicio, c->len);
+        c->inicio = 0;
+    }
+    if (c->len + extra <= c->cap) return 0;
+
+    size_t nueva = c->cap ? c->cap : 1024;
+    while (nueva < c->len + extra) nueva *= 2;
+    char *d = (char *)realloc(c->datos, nueva);
+    if (!d) {
+        perror("realloc cola de salida");
+        return -1;
+    }
+    c->datos = d;
+    c->cap = nueva;
+    return 0;
 }
 
-static int parse_args(int argc, char *argv[]) {
-    int opt;
-    int got_i = 0, got_f = 0, got_s = 0, got_t = 0, got_p = 0;
+static int cola_agregar(ColaSalida *c, const char *datos, size_t len) {
+    if (cola_reservar(c, len) != 0) return -1;
+    memcpy(c->datos + c->inicio + c->len, datos, len);
+    c->len += len;
+    return 0;
+}
 
-    while ((opt = getopt(argc, argv, "i:f:s:t:p:")) != -1) {
-        switch (opt) {
-            case 'i':
-                horaIni = atoi(optarg);
-                got_i = 1;
-                break;
-            case 'f':
-                horaFin = atoi(optarg);
-                got_f = 1;
-                break;
-            case 's':
-                segHoras = atoi(optarg);
-                got_s = 1;
-                break;
-            case 't':
-                aforoMaximo = atoi(optarg);
-                got_t = 1;
-                break;
-            case 'p':
-                strncpy(pipeRecibePath, optarg, sizeof(pipeRecibePath) - 1);
-                pipeRecibePath[sizeof(pipeRecibePath) - 1] = '\0';
-                got_p = 1;
-                break;
-            default:
-                uso(argv[0]);
-                return -1;
-        }
+// Una sesion simplemente se cierra: el agente ve el fin del socket. En un FIFO
+// lo pendiente se descarta y en su lugar queda un END|DESCONECTADO|agente por
+// cada agente de la conexion: sin el se quedarian esperando respuestas que ya
+// no van a llegar. Esos END salen cuando el FIFO vuelva a admitir escritura.
+static void desconectar_conexion_lenta(Fragmento *f, Conexion *c) {
+    fprintf(stderr, "Agente(s) de %s no consumen sus respuestas (%zu bytes pendientes), "
+            "se desconectan.\n", describir_conexion(c), c->cola.len);
+    int idx = (int)(c - f->conexiones);
+    if (c->tipo == CONEXION_SOCKET) {
+        cerrar_sesion(f, idx);
+        return;
     }
-
-    if (!got_i || !got_f || !got_s || !got_t || !got_p) {
-        uso(argv[0]);
-        return -1;
+    descartar_cola(&c->cola);
+    c->numDiferidas = 0;
+    c->estado = CONEXION_DESCONECTADA;
+
+    for (int i = 0; i < f->numAgentes; ++i) {
+        if (f->agentes[i].conexion != idx) continue;
+        char fin[MAX_NAME_LEN + 32];
+        int largo = snprintf(fin, sizeof(fin), "END|DESCONECTADO|%s\n", f->agentes[i].name);
+        cola_agregar(&c->cola, fin, (size_t)largo);
     }
-    if (horaIni < MIN_HOUR || horaIni > MAX_HOUR ||
-        horaFin < MIN_HOUR || horaFin > MAX_HOUR ||
-        horaIni >= horaFin) {
-        fprintf(stderr, "Rango de horas invaelido. Debe estar entre %d y %d y horaIni<horaFin.\n",
-                MIN_HOUR, MAX_HOUR);
+}
+
+// Abre el FIFO de la conexion si aun no esta abierto. Devuelve 0 si hay fd.
+// ENXIO (el agente todavia no tiene el FIFO abierto) no es error: los datos
+// quedan en cola y se reintenta en la siguiente vuelta del bucle.
+static int abrir_fifo_conexion(Conexion *c) {
+    if (c->fd != -1) return 0;
+    c->fd = open(c->fifoPath, O_WRONLY | O_NONBLOCK);
+    if (c->fd == -1) {
+        if (errno != ENXIO && errno != EINTR) {
+            fprintf(stderr, "No se pudo abrir FIFO de agente (%s): %s\n",
+                    c->fifoPath, strerror(errno));
+        }
         return -1;
     }
-    if (segHoras <= 0 || aforoMaximo <= 0) {
-        fprintf(stderr, "segHoras y total (aforo) deben ser > 0.\n");
+    return 0;
+}
+
+// En reproduccion lo que admitio el agente sale de la traza: el siguiente
+// registro debe ser la escritura hacia esta misma conexion.
+static int leer_escritura_grabada(Fragmento *f, int idx, RegistroTraza *r) {
+    int lr = leer_registro_traza(f, r, NULL, 0);
+    if (lr != 1 || (r->tipo != TRAZA_ESCRITURA && r->tipo != TRAZA_ESCRITURA_FIN) ||
+        r->conexion != idx) {
+        if (lr == 1) devolver_registro_traza(f, r);
+        marcar_traza_inconsistente(f, "una escritura hacia la conexion", idx);
         return -1;
     }
     return 0;
 }
 
-// ---------------------------------------------------------------------------
-// Bucle principal de recepciaIn
-// ---------------------------------------------------------------------------
-
-static void manejar_linea_mensaje(char *linea) {
-    trim_newline(linea);
-    if (linea[0] == '\0') return;
-
-    char tipo[16];
-    char *rest = NULL;
+static void vaciar_cola_grabada(Fragmento *f, Conexion *c) {
+    int idx = (int)(c - f->conexiones);
+    RegistroTraza r;
+    if (leer_escritura_grabada(f, idx, &r) != 0) return;
+    size_t n = r.valor < c->cola.len ? r.valor : c->cola.len;
+    c->cola.inicio += n;
+    c->cola.len -= n;
+    if (c->cola.len == 0) c->cola.inicio = 0;
+    if (r.tipo == TRAZA_ESCRITURA_FIN) cerrar_sesion(f, idx);
+}
 
-    char *token = strtok_r(linea, "|", &rest);
-    if (!token) return;
-    strncpy(tipo, token, sizeof(tipo) - 1);
-    tipo[sizeof(tipo) - 1] = '\0';
+// Escribe lo que admita el FIFO o socket sin bloquear. Soporta escrituras
+// parciales. Lo admitido queda en la traza: de eso dependen las decisiones de
+// agente lento.
+static void vaciar_cola_conexion(Fragmento *f, Conexion *c) {
+    ColaSalida *q = &c->cola;
+    if (q->len == 0) return;
+    if (reproduciendo) {
+        vaciar_cola_grabada(f, c);
+        return;
+    }
+    int idx = (int)(c - f->conexiones);
+    if (c->tipo == CONEXION_FIFO && abrir_fifo_conexion(c) != 0) {
+        grabar_traza(f, TRAZA_ESCRITURA, idx, 0, NULL, 0);
+        return;
+    }
 
-    if (strcmp(tipo, "REG") == 0) {
-        // REG|nombreAgente|fifoRespuesta
-        char *nombreAgente = strtok_r(NULL, "|", &rest);
-        char *fifoResp = strtok_r(NULL, "|", &rest);
-        if (!nombreAgente || !fifoResp) {
-            fprintf(stderr, "Mensaje REG mal formado.\n");
-            return;
+    size_t escritos = 0;
+    while (q->len > 0) {
+        size_t largo = q->len;
+        if (c->tipo == CONEXION_SOCKET && largo > MAX_PAQUETE_SOCKET) {
+            // Cada paquete termina en '\n': un read del agente nunca recibe
+            // media linea ni un paquete mas grande que su buffer
+            largo = MAX_PAQUETE_SOCKET;
+            while (largo > 0 && q->datos[q->inicio + largo - 1] != '\n') largo--;
         }
-        pthread_mutex_lock(&mutexDatos);
-        AgentInfo *ag = registrar_agente(nombreAgente, fifoResp);
-        if (ag) {
-            char msg[64];
-            snprintf(msg, sizeof(msg), "TIME|%d", horaActual);
-            enviar_mensaje_agente(ag, msg);
-            printf("Agente registrado: %s (FIFO=%s)\n", ag->name, ag->fifoPath);
-        }
-        pthread_mutex_unlock(&mutexDatos);
-    } else if (strcmp(tipo, "REQ") == 0) {
-        // REQ|nombreAgente|familia|hora|personas
-        char *nombreAgente = strtok_r(NULL, "|", &rest);
-        char *familia = strtok_r(NULL, "|", &rest);
-        char *horaStr = strtok_r(NULL, "|", &rest);
-        char *persStr = strtok_r(NULL, "|", &rest);
-        if (!nombreAgente || !familia || !horaStr || !persStr) {
-            fprintf(stderr, "Mensaje REQ mal formado.\n");
+        ssize_t n = write(c->fd, q->datos + q->inicio, largo);
+        if (n > 0) {
+            q->inicio += (size_t)n;
+            q->len -= (size_t)n;
+            escritos += (size_t)n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        // EPIPE u otro error: el lector cerro el FIFO, se reabre mas tarde.
+        // En un socket significa que el agente se fue.
+        if (n == -1 && errno != EPIPE && errno != ECONNRESET) {
+            fprintf(stderr, "Error escribiendo a %s: %s\n",
+                    describir_conexion(c), strerror(errno));
+        }
+        if (c->tipo == CONEXION_SOCKET) {
+            grabar_traza(f, TRAZA_ESCRITURA_FIN, idx, (uint32_t)escritos, NULL, 0);
+            cerrar_sesion(f, idx);
             return;
         }
-        int hora = atoi(horaStr);
-        int personas = atoi(persStr);
-        procesar_solicitud_reserva(nombreAgente, familia, hora, personas);
-    } else {
-        fprintf(stderr, "Tipo de mensaje desconocido: %s\n", tipo);
+        cerrar_fd_conexion(c);
+        break;
     }
+    grabar_traza(f, TRAZA_ESCRITURA, idx, (uint32_t)escritos, NULL, 0);
+    if (q->len == 0) q->inicio = 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (parse_args(argc, argv) != 0) {
-        return EXIT_FAILURE;
+// Aplica politicaLento antes de encolar len bytes. Devuelve -1 si la
+// conexion se cerro o quedo desconectada y no debe encolarse nada.
+static int admitir_en_cola(Fragmento *f, Conexion *c, size_t len) {
+    if (c->cola.len + len > limiteColaSalida) {
+        // Antes de juzgar a la conexion se escribe lo que su FIFO admita: solo
+        // cuenta lo que el FIFO rechazo, no lo que se encolo en esta vuelta
+        vaciar_cola_conexion(f, c);
+        if (!c->enUso) return -1;
+    }
+    if (c->cola.len + len > limiteColaSalida) {
+        if (politicaLento == POLITICA_DESCONECTAR) {
+            desconectar_conexion_lenta(f, c);
+            return -1;
+        }
+        // Con la politica suspender el mensaje se encola igual (no se pierde)
+        // y se dejan de admitir solicitudes de sus agentes hasta que drene.
+        if (c->estado != CONEXION_SUSPENDIDA) {
+            fprintf(stderr, "Agente(s) de %s lentos (%zu bytes pendientes), se suspende "
+                    "la admision de sus solicitudes.\n", describir_conexion(c), c->cola.len);
+            c->estado = CONEXION_SUSPENDIDA;
+        }
+    }
+    return 0;
+}
+
+static void enviar_mensaje_conexion(Fragmento *f, Conexion *c, const char *mensaje) {
+    if (c->estado == CONEXION_DESCONECTADA) return;
+
+    size_t len = strlen(mensaje);
+    if (admitir_en_cola(f, c, len + 1) != 0) return;
+    if (cola_agregar(&c->cola, mensaje, len) != 0 ||
+        cola_agregar(&c->cola, "\n", 1) != 0) {
+        desconectar_conexion_lenta(f, c);
+    }
+}
+
+static void enviar_mensaje_agente(Fragmento *f, AgentInfo *ag, const char *mensaje) {
+    if (!ag || !mensaje) return;
+    Conexion *c = conexion_de(f, ag);
+    if (c) enviar_mensaje_conexion(f, c, mensaje);
+}
+
+// ---------------------------------------------------------------------------
+// Turnos de respuesta
+//
+// Una REQ para un parque de otro fragmento se contesta alla y su respuesta
+// vuelve por la bandeja; mientras tanto el agente puede haber enviado mas
+// lineas que este fragmento contesta enseguida. Cada REG, REQ y QUERY toma un
+// turno al llegar y las respuestas se encolan en ese orden.
+// ---------------------------------------------------------------------------
+
+// Las retenidas se guardan ordenadas por turno (contado desde turnoEnviado) y
+// cada aviso detras de la respuesta de su turno: casi siempre llegan en orden,
+// asi que se insertan desde el final.
+static void retener_respuesta(Conexion *c, uint32_t turno, int esAviso, const char *texto,
+                              size_t largo) {
+    if (c->numRetenidas == c->capRetenidas) {
+        int cap = c->capRetenidas ? c->capRetenidas * 2 : 16;
+        void *d = realloc(c->retenidas, (size_t)cap * sizeof(*c->retenidas));
+        if (!d) {
+            perror("realloc respuestas retenidas");
+            return;
+        }
+        c->retenidas = d;
+        c->capRetenidas = cap;
+    }
+    int i = c->numRetenidas;
+    while (i > 0 && c->retenidas[i - 1].turno - c->turnoEnviado > turno - c->turnoEnviado) {
+        i--;
+    }
+    memmove(c->retenidas + i + 1, c->retenidas + i,
+            (size_t)(c->numRetenidas - i) * sizeof(*c->retenidas));
+    c->numRetenidas++;
+    RespuestaRetenida *r = &c->retenidas[i];
+    r->turno = turno;
+    r->esAviso = esAviso;
+    if (largo >= sizeof(r->texto)) largo = sizeof(r->texto) - 1;
+    memcpy(r->texto, texto, largo);
+    r->texto[largo] = '\0';
+}
+
+// Encola la respuesta de ese turno salvo que sea vacia (solo libera el turno)
+// o anterior al ultimo re-registro de la conexion.
+static void enviar_en_turno(Fragmento *f, Conexion *c, uint32_t turno, const char *texto) {
+    if (texto[0] != '\0' && (int32_t)(turno - c->turnoVigente) >= 0) {
+        enviar_mensaje_conexion(f, c, texto);
+    }
+}
+
+// Encola, en orden, las retenidas a las que ya les toco el turno, cada una
+// seguida de los avisos que esperaban detras de ella.
+static void liberar_retenidas(Fragmento *f, Conexion *c) {
+    int i = 0;
+    while (i < c->numRetenidas && c->retenidas[i].turno == c->turnoEnviado) {
+        uint32_t turno = c->turnoEnviado++;
+        do {
+            enviar_en_turno(f, c, turno, c->retenidas[i++].texto);
+            // Cerrar la sesion descarta las que quedaban
+            if (!c->enUso) return;
+        } while (i < c->numRetenidas && c->retenidas[i].esAviso &&
+                 c->retenidas[i].turno == turno);
+    }
+    memmove(c->retenidas, c->retenidas + i,
+            (size_t)(c->numRetenidas - i) * sizeof(*c->retenidas));
+    c->numRetenidas -= i;
+}
+
+// Encola la respuesta si es la siguiente de la conexion; si no, la retiene
+// hasta que lleguen las anteriores.
+static void entregar_en_turno(Fragmento *f, Conexion *c, uint32_t turno, const char *texto) {
+    if (turno != c->turnoEnviado) {
+        retener_respuesta(c, turno, 0, texto, strlen(texto));
+        return;
+    }
+    enviar_en_turno(f, c, turno, texto);
+    c->turnoEnviado++;
+    if (c->numRetenidas > 0) liberar_retenidas(f, c);
+}
+
+// Respuesta que da este fragmento al recibir la linea: toma el siguiente
+// turno y espera detras de las que aun estan en camino.
+static void responder_en_turno(Fragmento *f, Conexion *c, const char *texto) {
+    entregar_en_turno(f, c, c->turnoAsignado++, texto);
+}
+
+// Respuesta que contesto otro fragmento. Si la conexion se cerro (o se
+// reutilizo) mientras tanto, ya no hay a quien darsela.
+static void entregar_respuesta(Fragmento *f, int conexion, uint32_t generacion,
+                               uint32_t turno, const char *texto) {
+    if (conexion < 0 || conexion >= f->numConexiones) return;
+    Conexion *c = &f->conexiones[conexion];
+    if (!c->enUso || c->generacion != generacion) return;
+    entregar_en_turno(f, c, turno, texto);
+}
+
+// ---------------------------------------------------------------------------
+// Mensajes entre fragmentos
+//
+// Lo que un fragmento produce para otro en una vuelta del bucle se acumula en
+// hacia[] y se le entrega junto al final (un lock y un despertar por destino
+// y vuelta, no por mensaje). Si la bandeja del destino estaba vacia se
+// intercambian los arreglos en lugar de copiarlos.
+// ---------------------------------------------------------------------------
+
+static int lote_reservar(LoteMensajes *l, int extra) {
+    while (l->num + extra > l->cap) {
+        Mensaje *d = crecer(l->mensajes, &l->cap, sizeof(*d));
+        if (!d) return -1;
+        l->mensajes = d;
+    }
+    return 0;
+}
+
+static void lote_intercambiar(LoteMensajes *a, LoteMensajes *b) {
+    LoteMensajes t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// Nuevo mensaje para el fragmento destino, o NULL en reproduccion (no hay a
+// quien enviarlo).
+static Mensaje *mensaje_hacia(Fragmento *f, int destino) {
+    if (reproduciendo) return NULL;
+    LoteMensajes *l = &f->hacia[destino];
+    if (lote_reservar(l, 1) != 0) return NULL;
+    return &l->mensajes[l->num++];
+}
+
+static void despertar_fragmento(Fragmento *g) {
+    if (g->pipeDespertar[1] == -1) return;
+    // Si el pipe esta lleno ya hay un despertar pendiente
+    ssize_t r = write(g->pipeDespertar[1], "", 1);
+    (void)r;
+}
+
+static void despertar_todos(void) {
+    for (int k = 0; k < numFragmentos; ++k) {
+        despertar_fragmento(&fragmentos[k]);
+    }
+}
+
+static void publicar_mensajes(Fragmento *f) {
+    for (int k = 0; k < numFragmentos; ++k) {
+        LoteMensajes *l = &f->hacia[k];
+        if (l->num == 0) continue;
+        Fragmento *g = &fragmentos[k];
+        pthread_mutex_lock(&g->mutexBandeja);
+        if (g->bandeja.num == 0) {
+            lote_intercambiar(&g->bandeja, l);
+        } else if (lote_reservar(&g->bandeja, l->num) == 0) {
+            memcpy(g->bandeja.mensajes + g->bandeja.num, l->mensajes,
+                   (size_t)l->num * sizeof(*l->mensajes));
+            g->bandeja.num += l->num;
+        }
+        pthread_mutex_unlock(&g->mutexBandeja);
+        l->num = 0;
+        despertar_fragmento(g);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Avisos de entrada y salida
+//
+// En cada hora los agentes reciben ENTER|familia|hora|personas|agente y
+// EXIT|... por cada familia suya que entra o sale. Los avisos se agrupan por
+// conexion y se envian con un writev por conexion (por paquete en un socket),
+// apuntando directamente al texto guardado en cada ResNode: el costo en
+// llamadas al sistema depende de la cantidad de agentes, no de familias. Los
+// de agentes de otro fragmento le llegan como punteros a los mismos ResNode
+// (que no cambian despues de creados) y alla se agrupan igual.
+// ---------------------------------------------------------------------------
+
+static int agregar_aviso(Conexion *c, const ResNode *n) {
+    if (c->numAvisos == c->capAvisos) {
+        int cap = c->capAvisos ? c->capAvisos * 2 : 64;
+        void *d = realloc(c->avisos, (size_t)cap * sizeof(*c->avisos));
+        if (!d) {
+            perror("realloc avisos");
+            return -1;
+        }
+        c->avisos = d;
+        c->capAvisos = cap;
+    }
+    c->avisos[c->numAvisos].iov_base = (void *)n->aviso;
+    c->avisos[c->numAvisos].iov_len = n->largoAviso;
+    c->numAvisos++;
+    return 0;
+}
+
+// Descuenta w bytes escritos desde iov[*i]; un FIFO lleno puede cortar en
+// medio de un aviso.
+static void descontar_avisos(struct iovec *iov, int n, int *i, size_t w) {
+    while (w > 0 && *i < n) {
+        if (w >= iov[*i].iov_len) {
+            w -= iov[*i].iov_len;
+            (*i)++;
+        } else {
+            iov[*i].iov_base = (char *)iov[*i].iov_base + w;
+            iov[*i].iov_len -= w;
+            w = 0;
+        }
+    }
+}
+
+// Escribe con writev lo que la conexion admita sin bloquear. Devuelve los
+// bytes escritos y deja en *i el primer aviso pendiente; *cerrada indica que
+// el agente de la sesion se fue.
+static size_t escribir_avisos(Conexion *c, struct iovec *iov, int n, int *i, int *cerrada) {
+    size_t escritos = 0;
+    if (c->tipo == CONEXION_FIFO && abrir_fifo_conexion(c) != 0) return 0;
+    while (*i < n) {
+        // En un socket cada writev es un paquete: hasta MAX_PAQUETE_SOCKET
+        // bytes y solo lineas completas
+        int k = *i;
+        size_t total = 0;
+        while (k < n && k - *i < MAX_IOV_AVISOS) {
+            if (c->tipo == CONEXION_SOCKET && k > *i &&
+                total + iov[k].iov_len > MAX_PAQUETE_SOCKET) {
+                break;
+            }
+            total += iov[k].iov_len;
+            k++;
+        }
+        ssize_t w = writev(c->fd, iov + *i, k - *i);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno != EPIPE && errno != ECONNRESET) {
+                fprintf(stderr, "Error escribiendo a %s: %s\n",
+                        describir_conexion(c), strerror(errno));
+            }
+            if (c->tipo == CONEXION_SOCKET) {
+                *cerrada = 1;
+            } else {
+                cerrar_fd_conexion(c);
+            }
+            break;
+        }
+        escritos += (size_t)w;
+        descontar_avisos(iov, n, i, (size_t)w);
+        if (*i < k) break;
+    }
+    return escritos;
+}
+
+// Escribe los avisos de la conexion con writev si no tiene nada encolado
+// antes (se respeta el orden). Lo que no se pudo escribir se encola. Como en
+// vaciar_cola_conexion, lo que admitio el agente queda en la traza.
+static void enviar_avisos_conexion(Fragmento *f, Conexion *c) {
+    int idx = (int)(c - f->conexiones);
+    struct iovec *iov = c->avisos;
+    int n = c->numAvisos;
+    int i = 0;
+    c->numAvisos = 0;
+
+    if (c->cola.len == 0) {
+        int cerrada = 0;
+        if (reproduciendo) {
+            RegistroTraza r;
+            if (leer_escritura_grabada(f, idx, &r) == 0) {
+                descontar_avisos(iov, n, &i, r.valor);
+                cerrada = r.tipo == TRAZA_ESCRITURA_FIN;
+            }
+        } else {
+            size_t escritos = escribir_avisos(c, iov, n, &i, &cerrada);
+            grabar_traza(f, cerrada ? TRAZA_ESCRITURA_FIN : TRAZA_ESCRITURA, idx,
+                         (uint32_t)escritos, NULL, 0);
+        }
+        if (cerrada) {
+            cerrar_sesion(f, idx);
+            return;
+        }
+    }
+
+    for (; i < n; ++i) {
+        if (admitir_en_cola(f, c, iov[i].iov_len) != 0) return;
+        if (cola_agregar(&c->cola, iov[i].iov_base, iov[i].iov_len) != 0) {
+            desconectar_conexion_lenta(f, c);
+            return;
+        }
+    }
+}
+
+// Un aviso para un agente de este fragmento. Si su conexion tiene respuestas
+// retenidas espera detras de la ultima de ellas: una ENTER nunca llega antes
+// que la RESP de su reserva.
+static void agrupar_aviso(Fragmento *f, const ResNode *n, int *numTocadas) {
+    Conexion *c = conexion_de(f, &f->agentes[n->res.agente]);
+    if (!c || c->estado == CONEXION_DESCONECTADA) return;
+    if (c->numRetenidas > 0) {
+        retener_respuesta(c, c->retenidas[c->numRetenidas - 1].turno, 1, n->aviso,
+                          n->largoAviso - 1);
+        return;
+    }
+    if (c->numAvisos == 0) {
+        f->tocadas[(*numTocadas)++] = (int)(c - f->conexiones);
+    }
+    agregar_aviso(c, n);
+}
+
+// Los de agentes de otro fragmento se le envian al final de la vuelta.
+static void agregar_aviso_remoto(Fragmento *f, const ResNode *n) {
+    if (reproduciendo) return;
+    AvisosRemotos *a = &f->avisosHacia[n->res.fragmento];
+    if (a->num == a->cap) {
+        const ResNode **d = crecer(a->nodos, &a->cap, sizeof(*d));
+        if (!d) return;
+        a->nodos = d;
+    }
+    a->nodos[a->num++] = n;
+}
+
+static void agrupar_avisos(Fragmento *f, const ResNode *n, const ResNode *fin,
+                           int *numTocadas) {
+    for (; n != fin; n = n->next) {
+        if (n->res.fragmento == f->id) {
+            agrupar_aviso(f, n, numTocadas);
+        } else {
+            agregar_aviso_remoto(f, n);
+        }
+    }
+}
+
+static void enviar_avisos_tocadas(Fragmento *f, int numTocadas) {
+    for (int k = 0; k < numTocadas; ++k) {
+        Conexion *c = &f->conexiones[f->tocadas[k]];
+        if (c->enUso) {
+            enviar_avisos_conexion(f, c);
+        }
+        c->numAvisos = 0;
+    }
+}
+
+// Las reservas aceptadas para la hora en curso (ya transcurrida, o la
+// inicial) llegan a su lista de entradas despues del tick: se avisan desde la
+// nueva cabeza hasta lo ya avisado.
+static void avisar_entradas_tardias(Parque *p) {
+    ResNode *cabeza = p->entradasPorHora[p->horaActual];
+    if (cabeza == p->entradasAvisadas) return;
+    AvisosHora *a = &p->horasPorAvisar[p->numHorasPorAvisar++];
+    a->salidas = NULL;
+    a->entradas = cabeza;
+    a->finEntradas = p->entradasAvisadas;
+    p->entradasAvisadas = cabeza;
+}
+
+static void despachar_avisos_remotos(Fragmento *f) {
+    for (int k = 0; k < numFragmentos; ++k) {
+        AvisosRemotos *a = &f->avisosHacia[k];
+        if (a->num == 0) continue;
+        Mensaje *m = mensaje_hacia(f, k);
+        if (!m) {
+            a->num = 0;
+            continue;
+        }
+        m->tipo = MENSAJE_AVISOS;
+        m->avisos.nodos = a->nodos;
+        m->avisos.numNodos = a->num;
+        a->nodos = NULL;
+        a->num = 0;
+        a->cap = 0;
+    }
+}
+
+// Envia los avisos pendientes de los parques del fragmento: los de las horas
+// transcurridas y los ENTER de las reservas tardias, despues de sus
+// respuestas.
+static void enviar_avisos_pendientes(Fragmento *f) {
+    int hay = 0;
+    for (int i = 0; i < f->numParques; ++i) {
+        avisar_entradas_tardias(f->parques[i]);
+        hay |= f->parques[i]->numHorasPorAvisar > 0;
+    }
+    if (!hay) return;
+    grabar_traza(f, TRAZA_AVISOS, -1, 0, NULL, 0);
+
+    for (int i = 0; i < f->numParques; ++i) {
+        Parque *p = f->parques[i];
+        for (int h = 0; h < p->numHorasPorAvisar; ++h) {
+            int numTocadas = 0;
+            agrupar_avisos(f, p->horasPorAvisar[h].salidas, NULL, &numTocadas);
+            agrupar_avisos(f, p->horasPorAvisar[h].entradas, p->horasPorAvisar[h].finEntradas,
+                           &numTocadas);
+            enviar_avisos_tocadas(f, numTocadas);
+        }
+        p->numHorasPorAvisar = 0;
+    }
+    despachar_avisos_remotos(f);
+}
+
+// Avisos que dejo otro fragmento para agentes de este. Van a la traza por
+// tramos (un registro no admite mas de TRAZA_MAX_DATOS bytes) y cada tramo se
+// envia despues de grabarlo, asi la reproduccion agrupa exactamente los
+// mismos.
+static void recibir_avisos_remotos(Fragmento *f, const ResNode **nodos, int num) {
+    int i = 0;
+    while (i < num) {
+        size_t largo = 0;
+        int numTocadas = 0;
+        for (; i < num; ++i) {
+            const ResNode *n = nodos[i];
+            int32_t agente = n->res.agente;
+            uint16_t l = (uint16_t)n->largoAviso;
+            if (largo + sizeof(agente) + sizeof(l) + l > TRAZA_MAX_DATOS) break;
+            if (f->trazaSalida) {
+                memcpy(f->datosTraza + largo, &agente, sizeof(agente));
+                memcpy(f->datosTraza + largo + sizeof(agente), &l, sizeof(l));
+                memcpy(f->datosTraza + largo + sizeof(agente) + sizeof(l), n->aviso, l);
+            }
+            largo += sizeof(agente) + sizeof(l) + l;
+            agrupar_aviso(f, n, &numTocadas);
+        }
+        grabar_traza(f, TRAZA_AVISOS_REMOTOS, -1, 0, f->datosTraza, largo);
+        enviar_avisos_tocadas(f, numTocadas);
+    }
+}
+
+// Reproduce un tramo de TRAZA_AVISOS_REMOTOS con copias de los avisos.
+static int reproducir_avisos_remotos(Fragmento *f, const char *datos, size_t largo) {
+    int num = 0;
+    size_t pos = 0;
+    while (pos < largo) {
+        int32_t agente;
+        uint16_t l;
+        if (largo - pos < sizeof(agente) + sizeof(l)) return -1;
+        memcpy(&agente, datos + pos, sizeof(agente));
+        memcpy(&l, datos + pos + sizeof(agente), sizeof(l));
+        pos += sizeof(agente) + sizeof(l);
+        if (agente < 0 || agente >= f->numAgentes || l == 0 || l >= MAX_AVISO_LEN ||
+            largo - pos < l) {
+            return -1;
+        }
+        pos += l;
+        num++;
+    }
+    ResNode *nodos = calloc((size_t)num + 1, sizeof(*nodos));
+    if (!nodos) {
+        perror("calloc avisos");
+        return -1;
+    }
+    int numTocadas = 0;
+    pos = 0;
+    for (int i = 0; i < num; ++i) {
+        ResNode *n = &nodos[i];
+        int32_t agente;
+        uint16_t l;
+        memcpy(&agente, datos + pos, sizeof(agente));
+        memcpy(&l, datos + pos + sizeof(agente), sizeof(l));
+        pos += sizeof(agente) + sizeof(l);
+        n->res.fragmento = f->id;
+        n->res.agente = agente;
+        memcpy(n->aviso, datos + pos, l);
+        n->largoAviso = l;
+        pos += l;
+        agrupar_aviso(f, n, &numTocadas);
+    }
+    enviar_avisos_tocadas(f, numTocadas);
+    free(nodos);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// LaIgica de reservas
+//
+// Todo lo de esta seccion corre en el hilo del fragmento dueno del parque.
+// ---------------------------------------------------------------------------
+
+static int hay_cupo_bloque(const Parque *p, int horaInicio, int personas) {
+    int h1 = horaInicio;
+    int h2 = horaInicio + 1;
+    if (h1 < MIN_HOUR || h2 > MAX_HOUR) return 0;
+    if (p->personasPorHora[h1] + personas > p->aforo) return 0;
+    if (p->personasPorHora[h2] + personas > p->aforo) return 0;
+    return 1;
+}
+
+// Devuelve horaInicio si encuentra espacio, -1 en caso contrario. Es la
+// primera ventana de dos horas dentro de [horaActual, horaFin] en la que cada
+// hora admite a las personas (ver ventana.h).
+static int buscar_bloque_alternativo(const Parque *p, int personas) {
+    return ventana_buscar(p->personasPorHora, p->horaActual, p->horaFin + 1, 2,
+                          p->aforo - personas);
+}
+
+// Respuesta a una REQ o QUERY que no pasa por admision: una reserva se niega
+// y una consulta se contesta sin horas ni inicios
+// (DISP|agente|desde|hasta|personas|-|-), para que quien espera la respuesta
+// no se quede colgado.
+static void armar_respuesta_vacia(char *msg, size_t tam, char **campos, int n) {
+    const char *nombreAgente = campos[1];
+    const char *idSolicitud = campo_opcional(campos, n, 5);
+    int largo;
+    if (campos[0][0] == 'Q') {
+        largo = snprintf(msg, tam, "DISP|%s|%s|%s|%s|-|-", nombreAgente, campos[2],
+                         campos[3], campos[4]);
+    } else {
+        largo = snprintf(msg, tam, "RESP|NEG|%s|0|0", campos[2]);
+        if (idSolicitud) {
+            largo += snprintf(msg + largo, tam - (size_t)largo, "|%s", nombreAgente);
+        }
+    }
+    if (idSolicitud) {
+        snprintf(msg + largo, tam - (size_t)largo, "|%s", idSolicitud);
+    }
+}
+
+// La respuesta va a la conexion del agente, en su turno: directo si es de
+// este fragmento, por la bandeja del suyo si no.
+static void responder_solicitud(Fragmento *f, const Solicitud *s, const char *texto) {
+    if (s->origen == f->id) {
+        entregar_respuesta(f, s->conexion, s->generacion, s->turno, texto);
+        return;
+    }
+    Mensaje *m = mensaje_hacia(f, s->origen);
+    if (!m) return;
+    m->tipo = MENSAJE_RESPUESTA;
+    m->respuesta.conexion = s->conexion;
+    m->respuesta.generacion = s->generacion;
+    m->respuesta.turno = s->turno;
+    snprintf(m->respuesta.texto, sizeof(m->respuesta.texto), "%s", texto);
+}
+
+// Envia una RESP. Si la solicitud traia idSolicitud se agregan el agente y el
+// id para que un proceso que multiplexa varios agentes sepa a quien va.
+static void enviar_respuesta(Fragmento *f, const Solicitud *s, const char *nombreAgente,
+                             const char *idSolicitud, const char *respuesta) {
+    if (!idSolicitud) {
+        responder_solicitud(f, s, respuesta);
+        return;
+    }
+    char msg[MAX_LINE_LEN + MAX_NAME_LEN];
+    snprintf(msg, sizeof(msg), "%s|%s|%s", respuesta, nombreAgente, idSolicitud);
+    responder_solicitud(f, s, msg);
+}
+
+static void reservar(Parque *p, const Solicitud *s, const char *nombreAgente,
+                     const char *familia, int personas, int horaInicio, Reservation *r) {
+    strncpy(r->family, familia, sizeof(r->family) - 1);
+    r->family[sizeof(r->family) - 1] = '\0';
+    r->people = personas;
+    r->startHour = horaInicio;
+    r->endHour = horaInicio + 2;
+    r->fragmento = s->origen;
+    r->agente = s->agente;
+
+    p->personasPorHora[horaInicio] += personas;
+    p->personasPorHora[horaInicio + 1] += personas;
+    agregar_reserva_eventos(p, r, nombreAgente);
+}
+
+// REQ|nombreAgente|familia|hora|personas[|idSolicitud[|parque]], ya validada
+// al recibirla.
+static void procesar_solicitud_reserva(Fragmento *f, const Solicitud *s) {
+    Parque *p = &parques[s->parque];
+    char copia[MAX_LINE_LEN];
+    memcpy(copia, s->linea, sizeof(copia));
+    char *campos[MAX_CAMPOS];
+    int numCampos = separar_campos(copia, campos, MAX_CAMPOS);
+    const char *nombreAgente = campos[1];
+    const char *familia = campos[2];
+    int horaSolicitada = atoi(campos[3]);
+    int personas = atoi(campos[4]);
+    const char *idSolicitud = campo_opcional(campos, numCampos, 5);
+
+    char respuesta[256];
+
+    if (s->rechazada) {
+        // No cupo entre las retenidas de su conexion suspendida: se niega sin
+        // pasar por admision, pero cuenta como negada
+        p->solicitudesNegadas++;
+        publicar_ocupacion(p);
+        armar_respuesta_vacia(respuesta, sizeof(respuesta), campos, numCampos);
+        responder_solicitud(f, s, respuesta);
+        return;
+    }
+
+    texto_printf(&f->texto, "%sPeticiaIn recibida de agente=%s familia=%s hora=%d personas=%d\n",
+                 p->prefijo, nombreAgente, familia, horaSolicitada, personas);
+
+    if (personas <= 0 || personas > p->aforo ||
+        horaSolicitada < MIN_HOUR || horaSolicitada > MAX_HOUR ||
+        horaSolicitada + 1 > p->horaFin) {
+        p->solicitudesNegadas++;
+        snprintf(respuesta, sizeof(respuesta),
+                 "RESP|NEG|%s|0|0", familia);
+        publicar_ocupacion(p);
+        enviar_respuesta(f, s, nombreAgente, idSolicitud, respuesta);
+        return;
+    }
+
+    int esExtemporanea = horaSolicitada < p->horaActual;
+
+    if (!esExtemporanea && hay_cupo_bloque(p, horaSolicitada, personas)) {
+        // Reserva en la hora solicitada
+        Reservation r;
+        reservar(p, s, nombreAgente, familia, personas, horaSolicitada, &r);
+
+        p->solicitudesAceptadasExactas++;
+        snprintf(respuesta, sizeof(respuesta),
+                 "RESP|OK|%s|%d|%d",
+                 familia, r.startHour, r.endHour);
+        publicar_ocupacion(p);
+        enviar_respuesta(f, s, nombreAgente, idSolicitud, respuesta);
+        return;
+    }
+
+    // Buscar bloque alternativo (para extemporaeneas o sin cupo en la hora pedida)
+    int horaAlt = buscar_bloque_alternativo(p, personas);
+    if (horaAlt != -1) {
+        Reservation r;
+        reservar(p, s, nombreAgente, familia, personas, horaAlt, &r);
+
+        p->solicitudesReprogramadas++;
+        snprintf(respuesta, sizeof(respuesta),
+                 "RESP|REPROG|%s|%d|%d",
+                 familia, r.startHour, r.endHour);
+        publicar_ocupacion(p);
+        enviar_respuesta(f, s, nombreAgente, idSolicitud, respuesta);
+        return;
+    }
+
+    // No se encontraI ningaUn bloque
+    p->solicitudesNegadas++;
+    if (esExtemporanea) {
+        snprintf(respuesta, sizeof(respuesta),
+                 "RESP|NEG_EXTEMP|%s|0|0", familia);
+    } else {
+        snprintf(respuesta, sizeof(respuesta),
+                 "RESP|NEG|%s|0|0", familia);
+    }
+    publicar_ocupacion(p);
+    enviar_respuesta(f, s, nombreAgente, idSolicitud, respuesta);
+}
+
+// ---------------------------------------------------------------------------
+// Consultas de disponibilidad (QUERY)
+//
+// Se responden al recibirlas, en el fragmento del agente, con la copia
+// publicada por seqlock (ocupacion_leer), no con las listas de reservas: una
+// consulta no recorre ni modifica nada de la admision, cuesta lo mismo sin
+// importar cuantas reservas haya y no espera al fragmento del parque. Sale en
+// su turno, detras de las respuestas de REQ anteriores del mismo agente que
+// aun esten en camino.
+// ---------------------------------------------------------------------------
+
+// Copia publicada del parque. La de un parque propio solo la escribe este
+// hilo; la de uno ajeno cambia cuando su fragmento la publica, asi que lo
+// leido queda en la traza y la reproduccion lo toma de ahi.
+static void leer_parque_publicado(Fragmento *f, const Parque *p, EstadoOcupacion *e) {
+    if (p->fragmento == f || !reproduciendo) {
+        ocupacion_leer(p->ocupacion, e);
+        if (p->fragmento != f) {
+            grabar_traza(f, TRAZA_OCUPACION, p->indice, 0, e, sizeof(*e));
+        }
+        return;
+    }
+    RegistroTraza r;
+    int lr = leer_registro_traza(f, &r, (char *)e, sizeof(*e));
+    if (lr != 1 || r.tipo != TRAZA_OCUPACION || r.conexion != p->indice ||
+        r.largo != sizeof(*e)) {
+        if (lr == 1 && r.largo == 0) devolver_registro_traza(f, &r);
+        marcar_traza_inconsistente(f, "la ocupacion del parque", p->indice);
+        memset(e, 0, sizeof(*e));
+    }
+}
+
+// DISP|agente|desde|hasta|personas|libres|inicios[|idSolicitud]
+// libres: cupo restante de cada hora de [desde, hasta] separado por comas.
+// inicios: horas en las que se podria empezar una reserva de dos horas para
+// esas personas (desde la hora actual), o "-" si no hay ninguna.
+static void responder_consulta(Fragmento *f, Conexion *c, const AgentInfo *ag,
+                               const Parque *p, int desde, int hasta, int personas,
+                               const char *idSolicitud) {
+    EstadoOcupacion e;
+    leer_parque_publicado(f, p, &e);
+
+    if (desde < p->horaIni) desde = p->horaIni;
+    if (hasta > p->horaFin) hasta = p->horaFin;
+
+    char libres[OCUPACION_HORAS * 12 + 2] = "-";
+    size_t n = 0;
+    for (int h = desde; h <= hasta; ++h) {
+        n += (size_t)snprintf(libres + n, sizeof(libres) - n, "%s%d", n ? "," : "",
+                              p->aforo - e.personasPorHora[h]);
+    }
+
+    char inicios[OCUPACION_HORAS * 4 + 2] = "-";
+    n = 0;
+    int h = desde > e.horaActual ? desde : e.horaActual;
+    int limite = hasta + 1 < p->horaFin ? hasta + 1 : p->horaFin;
+    while (personas > 0 && h < limite) {
+        // Ventana de dos horas que empiece en [h, limite)
+        h = ventana_buscar(e.personasPorHora, h, limite + 1, 2, p->aforo - personas);
+        if (h == -1) break;
+        n += (size_t)snprintf(inicios + n, sizeof(inicios) - n, "%s%d", n ? "," : "", h);
+        h++;
+    }
+
+    char msg[MAX_NAME_LEN + sizeof(libres) + sizeof(inicios) + MAX_LINE_LEN];
+    int largo = snprintf(msg, sizeof(msg), "DISP|%s|%d|%d|%d|%s|%s", ag->name, desde, hasta,
+                         personas, libres, inicios);
+    if (idSolicitud) {
+        snprintf(msg + largo, sizeof(msg) - (size_t)largo, "|%s", idSolicitud);
+    }
+    responder_en_turno(f, c, msg);
+}
+
+// ---------------------------------------------------------------------------
+// Reloj de los parques
+//
+// Cada fragmento avanza las horas de sus parques en su propio bucle; lo que
+// imprimen va al buffer del fragmento.
+// ---------------------------------------------------------------------------
+
+static void imprimir_eventos_hora(BufferTexto *b, const Parque *p, int hora) {
+    ResNode *n;
+    int salen = 0;
+    int entran = 0;
+
+    n = p->salidasPorHora[hora];
+    while (n) {
+        texto_printf(b, "%s  Familia %s sale del parque (%d personas)\n",
+                     p->prefijo, n->res.family, n->res.people);
+        salen += n->res.people;
+        n = n->next;
+    }
+
+    n = p->entradasPorHora[hora];
+    while (n) {
+        texto_printf(b, "%s  Familia %s entra al parque (%d personas)\n",
+                     p->prefijo, n->res.family, n->res.people);
+        entran += n->res.people;
+        n = n->next;
+    }
+
+    if (salen == 0 && entran == 0) {
+        texto_printf(b, "%s  No hay cambios de familias en esta hora.\n", p->prefijo);
+    }
+}
+
+static void avanzar_hora(Fragmento *f, Parque *p, int hora) {
+    avisar_entradas_tardias(p);
+    p->horaActual = hora;
+    grabar_traza(f, TRAZA_HORA, p->indice, (uint32_t)hora, NULL, 0);
+    texto_printf(&f->texto, "\n%s=== Ha transcurrido una hora, son las %d hr ===\n",
+                 p->prefijo, p->horaActual);
+    imprimir_eventos_hora(&f->texto, p, p->horaActual);
+    publicar_tick(p, p->horaActual);
+
+    if (p->salidasPorHora[hora] || p->entradasPorHora[hora]) {
+        AvisosHora *a = &p->horasPorAvisar[p->numHorasPorAvisar++];
+        a->salidas = p->salidasPorHora[hora];
+        a->entradas = p->entradasPorHora[hora];
+        a->finEntradas = NULL;
+    }
+    p->entradasAvisadas = p->entradasPorHora[hora];
+    if (hora >= p->horaFin) {
+        p->terminado = 1;
+        publicar_ocupacion(p);
+    }
+}
+
+static void sumar_segundos(struct timespec *t, int segundos) {
+    t->tv_sec += segundos;
+}
+
+static int antes_que(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// Avanza las horas vencidas de los parques del fragmento. Devuelve cuantos
+// parques terminaron.
+static int avanzar_horas_vencidas(Fragmento *f) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    int terminados = 0;
+    for (int i = 0; i < f->numParques; ++i) {
+        Parque *p = f->parques[i];
+        while (!p->terminado && !antes_que(&ahora, &p->proximaHora)) {
+            avanzar_hora(f, p, p->horaActual + 1);
+            sumar_segundos(&p->proximaHora, p->segHoras);
+            if (p->terminado) terminados++;
+        }
+    }
+    return terminados;
+}
+
+// Milisegundos hasta la proxima hora de sus parques, a lo sumo
+// POLL_TIMEOUT_MS (los FIFOs de agentes sin lector se reintentan por vuelta).
+static int espera_poll(const Fragmento *f) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    long ms = POLL_TIMEOUT_MS;
+    for (int i = 0; i < f->numParques; ++i) {
+        const Parque *p = f->parques[i];
+        if (p->terminado) continue;
+        long falta = (p->proximaHora.tv_sec - ahora.tv_sec) * 1000 +
+                     (p->proximaHora.tv_nsec - ahora.tv_nsec + 999999) / 1000000;
+        if (falta < ms) ms = falta;
+    }
+    return ms < 0 ? 0 : (int)ms;
+}
+
+// ---------------------------------------------------------------------------
+// Reporte final
+// ---------------------------------------------------------------------------
+
+static void imprimir_reporte_final(const Parque *p) {
+    if (p->id[0] == '\0') {
+        printf("\n===== REPORTE FINAL DEL CONTROLADOR =====\n");
+    } else {
+        printf("\n===== REPORTE FINAL DEL PARQUE %s =====\n", p->id);
+    }
+
+    int maxPersonas = -1;
+    int minPersonas = 1e9;
+
+    for (int h = p->horaIni; h <= p->horaFin; ++h) {
+        if (p->personasPorHora[h] > maxPersonas) {
+            maxPersonas = p->personasPorHora[h];
+        }
+        if (p->personasPorHora[h] < minPersonas) {
+            minPersonas = p->personasPorHora[h];
+        }
+    }
+
+    printf("Horas pico (mayor ocupaciaIn = %d personas): ", maxPersonas);
+    for (int h = p->horaIni; h <= p->horaFin; ++h) {
+        if (p->personasPorHora[h] == maxPersonas) {
+            printf("%d ", h);
+        }
+    }
+    printf("\n");
+
+    printf("Horas de menor ocupaciaIn (=%d personas): ", minPersonas);
+    for (int h = p->horaIni; h <= p->horaFin; ++h) {
+        if (p->personasPorHora[h] == minPersonas) {
+            printf("%d ", h);
+        }
+    }
+    printf("\n");
+
+    printf("Solicitudes negadas: %d\n", p->solicitudesNegadas);
+    printf("Solicitudes aceptadas en su hora: %d\n", p->solicitudesAceptadasExactas);
+    printf("Solicitudes reprogramadas: %d\n", p->solicitudesReprogramadas);
+}
+
+// Totales de los parques reportados (solo con -k o varios parques).
+static void imprimir_reporte_agregado(void) {
+    int aforoTotal = 0, negadas = 0, exactas = 0, reprogramadas = 0, reportados = 0;
+    const Parque *pico = NULL;
+    int horaPico = 0;
+
+    for (int i = 0; i < numParques; ++i) {
+        const Parque *p = &parques[i];
+        if (!p->fragmento->activo) continue;
+        reportados++;
+        aforoTotal += p->aforo;
+        negadas += p->solicitudesNegadas;
+        exactas += p->solicitudesAceptadasExactas;
+        reprogramadas += p->solicitudesReprogramadas;
+        for (int h = p->horaIni; h <= p->horaFin; ++h) {
+            if (!pico || p->personasPorHora[h] > pico->personasPorHora[horaPico]) {
+                pico = p;
+                horaPico = h;
+            }
+        }
+    }
+    if (!pico) return;
+
+    printf("\n===== REPORTE AGREGADO (%d parques, %d fragmentos) =====\n",
+           reportados, numFragmentos);
+    printf("Aforo total: %d\n", aforoTotal);
+    printf("Mayor ocupaciaIn: %d personas en %s a las %d\n",
+           pico->personasPorHora[horaPico], pico->id, horaPico);
+    printf("Solicitudes negadas: %d\n", negadas);
+    printf("Solicitudes aceptadas en su hora: %d\n", exactas);
+    printf("Solicitudes reprogramadas: %d\n", reprogramadas);
+}
+
+// Un reporte por parque y, con -k, el agregado. En reproduccion solo los
+// parques de los fragmentos reproducidos.
+static void imprimir_reportes(void) {
+    for (int i = 0; i < numParques; ++i) {
+        if (parques[i].fragmento->activo) imprimir_reporte_final(&parques[i]);
+    }
+    if (parques[0].id[0] != '\0') {
+        imprimir_reporte_agregado();
+    }
+}
+
+static void notificar_fin_a_agentes(Fragmento *f) {
+    for (int i = 0; i < f->numAgentes; ++i) {
+        AgentInfo *ag = &f->agentes[i];
+        char msg[MAX_NAME_LEN + 32];
+        snprintf(msg, sizeof(msg), "END|FIN_SIMULACION|%.*s", MAX_NAME_LEN - 1, ag->name);
+        enviar_mensaje_agente(f, ag, msg);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Parseo de argumentos
+// ---------------------------------------------------------------------------
+
+static void uso(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s {-i horaIni -f horaFin -s segHoras -t total | -k archivoParques} "
+            "{-p pipeRecibe | -u socket | ambos} [-h fragmentos] "
+            "[-q bytesColaAgente] [-c suspender|desconectar] [-m archivoOcupacion] "
+            "[-r trazaGrabar]\n"
+            "     %s -R trazaReproducir [-R trazaReproducir ...] [-m archivoOcupacion]\n",
+            prog, prog);
+}
+
+static int validar_parque(const char *id, int ini, int fin, int seg, int aforo) {
+    if (ini < MIN_HOUR || ini > MAX_HOUR || fin < MIN_HOUR || fin > MAX_HOUR || ini >= fin) {
+        fprintf(stderr, "%s%sRango de horas invaelido. Debe estar entre %d y %d y "
+                "horaIni<horaFin.\n", id, id[0] ? ": " : "", MIN_HOUR, MAX_HOUR);
+        return -1;
+    }
+    if (seg <= 0 || aforo <= 0) {
+        fprintf(stderr, "%s%ssegHoras y total (aforo) deben ser > 0.\n",
+                id, id[0] ? ": " : "");
+        return -1;
+    }
+    return 0;
+}
+
+static Parque *agregar_parque(const char *id, int ini, int fin, int seg, int aforo) {
+    if (numParques >= MAX_PARQUES) {
+        fprintf(stderr, "Demasiados parques (maximo %d).\n", MAX_PARQUES);
+        return NULL;
+    }
+    Parque *p = &parques[numParques];
+    p->indice = numParques++;
+    snprintf(p->id, sizeof(p->id), "%s", id);
+    if (id[0] != '\0') snprintf(p->prefijo, sizeof(p->prefijo), "[%s] ", id);
+    p->horaIni = ini;
+    p->horaFin = fin;
+    p->segHoras = seg;
+    p->aforo = aforo;
+    p->horaActual = ini;
+    return p;
+}
+
+// Una linea por parque: id,horaIni,horaFin,segHoras,aforo. Se ignoran las
+// lineas vacias y las que empiezan con '#'.
+static int cargar_parques(const char *ruta) {
+    FILE *f = fopen(ruta, "r");
+    if (!f) {
+        perror("fopen archivo de parques");
+        return -1;
+    }
+    char linea[MAX_LINE_LEN];
+    int numLinea = 0;
+    int error = 0;
+    while (!error && fgets(linea, sizeof(linea), f)) {
+        numLinea++;
+        trim_newline(linea);
+        if (linea[0] == '\0' || linea[0] == '#') continue;
+
+        char id[MAX_PARQUE_LEN + 1];
+        int ini, fin, seg, aforo;
+        if (sscanf(linea, "%32[^,],%d,%d,%d,%d", id, &ini, &fin, &seg, &aforo) != 5 ||
+            strlen(id) >= MAX_PARQUE_LEN || strchr(id, '|') || strchr(id, ' ')) {
+            fprintf(stderr, "%s:%d: se esperaba id,horaIni,horaFin,segHoras,aforo "
+                    "(id de hasta %d caracteres, sin '|' ni espacios).\n",
+                    ruta, numLinea, MAX_PARQUE_LEN - 1);
+            error = 1;
+            break;
+        }
+        for (int i = 0; i < numParques; ++i) {
+            if (strcmp(parques[i].id, id) == 0) {
+                fprintf(stderr, "%s:%d: parque repetido: %s\n", ruta, numLinea, id);
+                error = 1;
+            }
+        }
+        if (error || validar_parque(id, ini, fin, seg, aforo) != 0 ||
+            !agregar_parque(id, ini, fin, seg, aforo)) {
+            error = 1;
+        }
+    }
+    fclose(f);
+    if (!error && numParques == 0) {
+        fprintf(stderr, "%s no define ningun parque.\n", ruta);
+        error = 1;
+    }
+    return error ? -1 : 0;
+}
+
+static int parse_args(int argc, char *argv[]) {
+    int opt;
+    int got_i = 0, got_f = 0, got_s = 0, got_t = 0, got_p = 0, got_u = 0;
+
+    while ((opt = getopt(argc, argv, "i:f:s:t:p:u:q:c:m:r:R:k:h:")) != -1) {
+        switch (opt) {
+            case 'i':
+                horaIni = atoi(optarg);
+                got_i = 1;
+                break;
+            case 'f':
+                horaFin = atoi(optarg);
+                got_f = 1;
+                break;
+            case 's':
+                segHoras = atoi(optarg);
+                got_s = 1;
+                break;
+            case 't':
+                aforoMaximo = atoi(optarg);
+                got_t = 1;
+                break;
+            case 'p':
+                strncpy(pipeRecibePath, optarg, sizeof(pipeRecibePath) - 1);
+                pipeRecibePath[sizeof(pipeRecibePath) - 1] = '\0';
+                got_p = 1;
+                break;
+            case 'u':
+                if (strlen(optarg) >= sizeof(socketPath)) {
+                    fprintf(stderr, "Ruta de socket demasiado larga: %s\n", optarg);
+                    return -1;
+                }
+                strcpy(socketPath, optarg);
+                got_u = 1;
+                break;
+            case 'q':
+                if (atol(optarg) <= 0) {
+                    fprintf(stderr, "El limite de la cola de salida debe ser > 0.\n");
+                    return -1;
+                }
+                limiteColaSalida = (size_t)atol(optarg);
+                break;
+            case 'c':
+                if (strcmp(optarg, "suspender") == 0) {
+                    politicaLento = POLITICA_SUSPENDER;
+                } else if (strcmp(optarg, "desconectar") == 0) {
+                    politicaLento = POLITICA_DESCONECTAR;
+                } else {
+                    fprintf(stderr, "Politica de agente lento desconocida: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'm':
+                strncpy(archivoOcupacionPath, optarg, sizeof(archivoOcupacionPath) - 1);
+                archivoOcupacionPath[sizeof(archivoOcupacionPath) - 1] = '\0';
+                break;
+            case 'r':
+                strncpy(trazaGrabarPath, optarg, sizeof(trazaGrabarPath) - 1);
+                trazaGrabarPath[sizeof(trazaGrabarPath) - 1] = '\0';
+                break;
+            case 'R':
+                if (numTrazasReproducir >= MAX_FRAGMENTOS) {
+                    fprintf(stderr, "Demasiadas trazas (maximo %d).\n", MAX_FRAGMENTOS);
+                    return -1;
+                }
+                snprintf(trazasReproducir[numTrazasReproducir++], sizeof(trazasReproducir[0]),
+                         "%s", optarg);
+                break;
+            case 'k':
+                strncpy(archivoParquesPath, optarg, sizeof(archivoParquesPath) - 1);
+                archivoParquesPath[sizeof(archivoParquesPath) - 1] = '\0';
+                break;
+            case 'h':
+                fragmentosPedidos = atoi(optarg);
+                if (fragmentosPedidos <= 0) {
+                    fprintf(stderr, "La cantidad de fragmentos debe ser > 0.\n");
+                    return -1;
+                }
+                break;
+            default:
+                uso(argv[0]);
+                return -1;
+        }
+    }
+
+    if (numTrazasReproducir > 0) {
+        // Los parques y su reparto salen de la cabecera de las trazas
+        if (got_p || got_u || trazaGrabarPath[0] != '\0' || archivoParquesPath[0] != '\0' ||
+            fragmentosPedidos > 0) {
+            fprintf(stderr, "-R no admite -p, -u, -r, -k ni -h.\n");
+            return -1;
+        }
+        return 0;
+    }
+    if (!got_p && !got_u) {
+        uso(argv[0]);
+        return -1;
+    }
+    if (archivoParquesPath[0] != '\0') {
+        if (got_i || got_f || got_s || got_t) {
+            fprintf(stderr, "Con -k las horas y el aforo de cada parque salen del archivo; "
+                    "no se admiten -i, -f, -s ni -t.\n");
+            return -1;
+        }
+        return cargar_parques(archivoParquesPath);
+    }
+    if (!got_i || !got_f || !got_s || !got_t) {
+        uso(argv[0]);
+        return -1;
+    }
+    if (validar_parque("", horaIni, horaFin, segHoras, aforoMaximo) != 0) {
+        return -1;
+    }
+    return agregar_parque("", horaIni, horaFin, segHoras, aforoMaximo) ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Recepcion
+//
+// Cada fragmento lee sus FIFOs de entrada y sus sesiones. REG y QUERY se
+// contestan aqui mismo; una REQ se procesa aqui si su parque es de este
+// fragmento y si no se reenvia al que lo atiende.
+// ---------------------------------------------------------------------------
+
+// Avisa al agente que su REG no se acepto: ERR|REG|motivo|agente. Si nadie
+// mas usa su FIFO no queda conexion donde encolarlo, asi que se intenta una
+// unica escritura directa (el mensaje es corto y el agente ya tiene su FIFO
+// abierto para lectura).
+static void rechazar_registro(Fragmento *f, int idx, const char *fifoResp,
+                              const char *nombreAgente, const char *motivo) {
+    char msg[MAX_NAME_LEN + 32];
+    int largo = snprintf(msg, sizeof(msg), "ERR|REG|%s|%.*s\n", motivo, MAX_NAME_LEN - 1,
+                         nombreAgente);
+    fprintf(stderr, "Registro rechazado (%s): %s\n", motivo, nombreAgente);
+
+    if (idx != -1 && (f->conexiones[idx].tipo == CONEXION_SOCKET ||
+                      f->conexiones[idx].numAgentes > 0)) {
+        msg[largo - 1] = '\0';
+        responder_en_turno(f, &f->conexiones[idx], msg);
+        return;
+    }
+    if (idx != -1) {
+        cerrar_fd_conexion(&f->conexiones[idx]);
+        f->conexiones[idx].enUso = 0;
+    }
+    if (reproduciendo) return;
+    int fd = open(fifoResp, O_WRONLY | O_NONBLOCK);
+    if (fd == -1) return;
+    ssize_t w = write(fd, msg, (size_t)largo);
+    (void)w;
+    close(fd);
+}
+
+// Parque por id; sin id (REG sin el campo) el primero.
+static Parque *buscar_parque(const char *id) {
+    if (!id) return &parques[0];
+    for (int i = 0; i < numParques; ++i) {
+        if (strcmp(parques[i].id, id) == 0) return &parques[i];
+    }
+    return NULL;
+}
+
+// Guarda una REQ o QUERY de una conexion suspendida para atenderla cuando
+// drene. Devuelve -1 si ya no caben mas: en ese caso el que llama la contesta
+// de inmediato, nunca la descarta.
+static int diferir_solicitud(Conexion *c, const char *linea) {
+    if (c->numDiferidas >= MAX_DIFERIDAS * c->numAgentes) return -1;
+    if (c->numDiferidas == c->capDiferidas) {
+        int cap = c->capDiferidas ? c->capDiferidas * 2 : MAX_DIFERIDAS;
+        void *d = realloc(c->diferidas, (size_t)cap * sizeof(*c->diferidas));
+        if (!d) {
+            perror("realloc diferidas");
+            return -1;
+        }
+        c->diferidas = d;
+        c->capDiferidas = cap;
+    }
+    snprintf(c->diferidas[c->numDiferidas], MAX_LINE_LEN, "%s", linea);
+    c->numDiferidas++;
+    return 0;
+}
+
+// Procesa la REQ aqui si su parque es de este fragmento; si no, la deja para
+// el fragmento del parque, que la contesta por la bandeja de este.
+static void rutear_solicitud(Fragmento *f, Conexion *c, const Solicitud *s) {
+    Fragmento *dueno = parques[s->parque].fragmento;
+    if (dueno == f) {
+        procesar_solicitud_reserva(f, s);
+        return;
+    }
+    Mensaje *m = mensaje_hacia(f, dueno->id);
+    if (m) {
+        m->tipo = MENSAJE_SOLICITUD;
+        m->solicitud = *s;
+        atomic_fetch_add(&turnosEnVuelo, 1);
+    } else if (!reproduciendo) {
+        // Sin memoria para reenviarla: al menos libera su turno
+        entregar_en_turno(f, c, s->turno, "");
+    }
+}
+
+// REQ o QUERY de un agente de este fragmento, ya validada. rechazada: no cupo
+// entre las diferidas de su conexion suspendida; una QUERY se contesta vacia y
+// una REQ se niega en el fragmento de su parque, que la cuenta como negada.
+static void atender_solicitud(Fragmento *f, AgentInfo *ag, Conexion *c, char **campos,
+                              int n, const char *original, int rechazada) {
+    int esConsulta = campos[0][0] == 'Q';
+    const char *idStr = campo_opcional(campos, n, 5);
+    const char *parqueStr = campo_opcional(campos, n, 6);
+    Parque *p = parqueStr ? buscar_parque(parqueStr) : ag->parque;
+    if (!p || (esConsulta && rechazada)) {
+        if (!p) {
+            fprintf(stderr, "%s para un parque desconocido: %s\n",
+                    esConsulta ? "Consulta" : "Solicitud", parqueStr);
+        }
+        char msg[MAX_LINE_LEN + MAX_NAME_LEN];
+        armar_respuesta_vacia(msg, sizeof(msg), campos, n);
+        responder_en_turno(f, c, msg);
+        return;
+    }
+    if (esConsulta) {
+        responder_consulta(f, c, ag, p, atoi(campos[2]), atoi(campos[3]), atoi(campos[4]),
+                           idStr);
+        return;
+    }
+    Solicitud s;
+    s.parque = p->indice;
+    s.origen = f->id;
+    s.agente = (int)(ag - f->agentes);
+    s.conexion = (int)(c - f->conexiones);
+    s.generacion = c->generacion;
+    s.turno = c->turnoAsignado++;
+    s.rechazada = rechazada;
+    memcpy(s.linea, original, strlen(original) + 1);
+    rutear_solicitud(f, c, &s);
+}
+
+// origen es la sesion de socket por la que llego la linea, -1 si llego por un
+// FIFO de entrada.
+static void manejar_linea_mensaje(Fragmento *f, char *linea, int origen) {
+    trim_newline(linea);
+    if (linea[0] == '\0') return;
+
+    char original[MAX_LINE_LEN];
+    strncpy(original, linea, sizeof(original) - 1);
+    original[sizeof(original) - 1] = '\0';
+
+    char *campos[MAX_CAMPOS];
+    int n = separar_campos(linea, campos, MAX_CAMPOS);
+    const char *tipo = campos[0];
+
+    if (strcmp(tipo, "REG") == 0) {
+        // REG|nombreAgente|fifoRespuesta[|parque] por un FIFO,
+        // REG|nombreAgente[||parque] por una sesion (las respuestas vuelven
+        // por el mismo socket). Sin parque se usa el primero.
+        const char *nombreAgente = campo_opcional(campos, n, 1);
+        const char *fifoResp = campo_opcional(campos, n, 2);
+        const char *parqueStr = campo_opcional(campos, n, 3);
+        if (!nombreAgente || (origen == -1 && !fifoResp)) {
+            fprintf(stderr, "Mensaje REG mal formado.\n");
+            return;
+        }
+        int idx = origen != -1 ? origen : obtener_conexion_fifo(f, fifoResp);
+        Parque *p = buscar_parque(parqueStr);
+        if (idx != -1 && !p) {
+            rechazar_registro(f, idx, fifoResp, nombreAgente, "PARQUE_DESCONOCIDO");
+            return;
+        }
+        AgentInfo *ag = idx != -1 ? registrar_agente(f, nombreAgente, idx) : NULL;
+        if (ag) {
+            // La hora de su parque, desde la copia publicada
+            ag->parque = p;
+            EstadoOcupacion e;
+            leer_parque_publicado(f, p, &e);
+            char msg[MAX_NAME_LEN + 32];
+            snprintf(msg, sizeof(msg), "TIME|%d|%s", e.horaActual, ag->name);
+            responder_en_turno(f, conexion_de(f, ag), msg);
+            if (p->id[0] == '\0') {
+                texto_printf(&f->texto, "Agente registrado: %s (%s=%s)\n", ag->name,
+                             origen != -1 ? "sesion" : "FIFO",
+                             describir_conexion(conexion_de(f, ag)));
+            } else {
+                texto_printf(&f->texto, "Agente registrado: %s (%s=%s, parque=%s)\n", ag->name,
+                             origen != -1 ? "sesion" : "FIFO",
+                             describir_conexion(conexion_de(f, ag)), p->id);
+            }
+        } else {
+            rechazar_registro(f, idx, fifoResp, nombreAgente,
+                              idx == -1 ? "MAX_CONEXIONES" : "MAX_AGENTES");
+        }
+    } else if (strcmp(tipo, "REQ") == 0 || strcmp(tipo, "QUERY") == 0) {
+        // REQ|nombreAgente|familia|hora|personas[|idSolicitud[|parque]]
+        // QUERY|nombreAgente|horaDesde|horaHasta|personas[|idSolicitud[|parque]]
+        // El id puede ir vacio para nombrar solo el parque.
+        const char *clase = tipo[0] == 'Q' ? "Consulta" : "Solicitud";
+        if (!campo_opcional(campos, n, 1) || !campo_opcional(campos, n, 2) ||
+            !campo_opcional(campos, n, 3) || !campo_opcional(campos, n, 4)) {
+            fprintf(stderr, "Mensaje %s mal formado.\n", tipo);
+            return;
+        }
+        const char *nombreAgente = campos[1];
+        AgentInfo *ag = buscar_agente(f, nombreAgente);
+        if (!ag) {
+            fprintf(stderr, "%s de agente no registrado: %s\n", clase, nombreAgente);
+            return;
+        }
+        Conexion *c = conexion_de(f, ag);
+        if (!c || c->estado == CONEXION_DESCONECTADA) {
+            // No podria recibir la respuesta: no se admite hasta que se re-registre
+            fprintf(stderr, "%s de agente desconectado ignorada: %s\n", clase, nombreAgente);
+            return;
+        }
+        if (c->estado == CONEXION_SUSPENDIDA) {
+            // Sus respuestas no se estan leyendo: se atiende cuando drene, o se
+            // contesta ya si no cabe
+            if (diferir_solicitud(c, original) != 0) {
+                atender_solicitud(f, ag, c, campos, n, original, 1);
+            }
+            return;
+        }
+        atender_solicitud(f, ag, c, campos, n, original, 0);
+    } else {
+        fprintf(stderr, "Tipo de mensaje desconocido: %s\n", tipo);
+    }
+}
+
+// Una sesion suspendida no se lee: lo que ya estaba en su buffer queda ahi y
+// lo demas se queda en el socket, asi el kernel frena al agente en vez de
+// acumular sus REQ aqui.
+static int sesion_suspendida(Fragmento *f, int origen) {
+    return origen != -1 && f->conexiones[origen].estado == CONEXION_SUSPENDIDA;
+}
+
+// Procesa las lineas completas del buffer. Con una sesion se detiene si la
+// sesion se cierra o se suspende; lo no procesado queda en el buffer.
+static void procesar_buffer_entrada(Fragmento *f, BufferEntrada *b, int origen) {
+    size_t inicio = 0;
+    for (size_t i = 0; i < b->len; ++i) {
+        if (b->datos[i] != '\n') continue;
+        char linea[MAX_LINE_LEN];
+        size_t largo = i - inicio;
+        if (largo >= sizeof(linea)) {
+            fprintf(stderr, "Mensaje demasiado largo, se descarta.\n");
+        } else {
+            memcpy(linea, b->datos + inicio, largo);
+            linea[largo] = '\0';
+            f->mensajes++;
+            manejar_linea_mensaje(f, linea, origen);
+            // Pudo cerrarse por la politica de agente lento
+            if (origen != -1 && !f->conexiones[origen].enUso) return;
+        }
+        inicio = i + 1;
+        if (sesion_suspendida(f, origen)) break;
     }
+    memmove(b->datos, b->datos + inicio, b->len - inicio);
+    b->len -= inicio;
+}
+
+// Procesa n bytes recien agregados al buffer (leidos o tomados de la traza).
+static void recibir_entrada(Fragmento *f, BufferEntrada *b, size_t n, int origen) {
+    b->len += n;
+    procesar_buffer_entrada(f, b, origen);
+    if (origen != -1 && !f->conexiones[origen].enUso) return;
+    if (b->len == sizeof(b->datos) - 1) {
+        fprintf(stderr, "Linea sin terminador demasiado larga, se descarta.\n");
+        b->len = 0;
+    }
+}
+
+// Lee lo disponible de un FIFO de entrada (origen -1) o de una sesion y
+// procesa cada linea completa. Cada lectura se graba en la traza tal como
+// llego (con el codigo "registro" de su entrada) y se procesa enseguida.
+// Devuelve 1 si la sesion se cerro.
+static int leer_entrada(Fragmento *f, int fd, BufferEntrada *b, int origen, int registro) {
+    while (!sesion_suspendida(f, origen)) {
+        ssize_t n = read(fd, b->datos + b->len, sizeof(b->datos) - 1 - b->len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (origen != -1) return 1;
+            perror("read pipeRecibe");
+            return 0;
+        }
+        if (n == 0) return origen != -1 ? 1 : 0;
+
+        grabar_traza(f, TRAZA_LECTURA, registro, 0, b->datos + b->len, (size_t)n);
+        recibir_entrada(f, b, (size_t)n, origen);
+        if (origen != -1 && !f->conexiones[origen].enUso) return 0;
+    }
+    return 0;
+}
+
+static void vaciar_colas_pendientes(Fragmento *f) {
+    for (int i = 0; i < f->numConexiones; ++i) {
+        if (f->conexiones[i].enUso) {
+            vaciar_cola_conexion(f, &f->conexiones[i]);
+        }
+    }
+}
+
+// La conexion suspendida i vuelve a estar activa: se atienden, en orden, las
+// REQ y QUERY retenidas.
+static void reanudar_conexion(Fragmento *f, int i) {
+    Conexion *c = &f->conexiones[i];
+    c->estado = CONEXION_ACTIVA;
+    texto_printf(&f->texto, "Agente(s) de %s vuelven a consumir respuestas, se reanuda su "
+                 "admision.\n", describir_conexion(c));
+
+    int k = 0;
+    while (k < c->numDiferidas && c->estado == CONEXION_ACTIVA) {
+        char linea[MAX_LINE_LEN];
+        memcpy(linea, c->diferidas[k], sizeof(linea));
+        k++;
+        manejar_linea_mensaje(f, linea, c->tipo == CONEXION_SOCKET ? i : -1);
+        if (!c->enUso) return;
+    }
+    if (c->estado == CONEXION_DESCONECTADA) return;
+    // Si volvio a suspenderse, lo restante sigue retenido en orden
+    memmove(c->diferidas, c->diferidas + k,
+            (size_t)(c->numDiferidas - k) * sizeof(*c->diferidas));
+    c->numDiferidas -= k;
+    // Una sesion sigue con lo que quedo sin procesar en su buffer; el resto
+    // lo trae poll en cuanto se la vuelva a vigilar para lectura
+    if (c->tipo == CONEXION_SOCKET && c->estado == CONEXION_ACTIVA) {
+        procesar_buffer_entrada(f, c->entrada, i);
+    }
+}
+
+// Una conexion suspendida se reanuda cuando su cola baja a la mitad del
+// limite. Cuando eso ocurre depende de lo que consumio el agente, asi que
+// queda en la traza.
+static void reanudar_conexiones_suspendidas(Fragmento *f) {
+    for (int i = 0; i < f->numConexiones; ++i) {
+        Conexion *c = &f->conexiones[i];
+        if (!c->enUso || c->estado != CONEXION_SUSPENDIDA ||
+            c->cola.len > limiteColaSalida / 2) {
+            continue;
+        }
+        grabar_traza(f, TRAZA_REANUDA, i, 0, NULL, 0);
+        reanudar_conexion(f, i);
+    }
+}
+
+static long ms_desde(const struct timespec *t0) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - t0->tv_sec) * 1000 + (t.tv_nsec - t0->tv_nsec) / 1000000;
+}
 
-    horaActual = horaIni;
-    printf("Controlador iniciado. SimulaciaIn de %d a %d, aforo=%d, segHoras=%d\n",
-           horaIni, horaFin, aforoMaximo, segHoras);
+// Intenta entregar todo lo pendiente (p. ej. END) durante a lo sumo maxMs.
+static void drenar_colas(Fragmento *f, long maxMs) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    struct pollfd *pfds = f->pfds;
+
+    while (1) {
+        vaciar_colas_pendientes(f);
+        int n = 0;
+        int pendientes = 0;
+        for (int i = 0; i < f->numConexiones; ++i) {
+            Conexion *c = &f->conexiones[i];
+            if (!c->enUso || c->cola.len == 0) continue;
+            pendientes++;
+            if (c->fd != -1) {
+                pfds[n].fd = c->fd;
+                pfds[n].events = POLLOUT;
+                n++;
+            }
+        }
+        if (pendientes == 0) return;
+
+        long restante = maxMs - ms_desde(&t0);
+        if (restante <= 0) {
+            fprintf(stderr, "%d conexion(es) no recibieron todos sus mensajes antes de "
+                    "terminar.\n", pendientes);
+            return;
+        }
+        poll(pfds, (nfds_t)n, restante < POLL_TIMEOUT_MS ? (int)restante : POLL_TIMEOUT_MS);
+    }
+}
 
-    // Crear FIFO principal si no existe
-    if (mkfifo(pipeRecibePath, 0666) == -1) {
+static int abrir_fifo_entrada(EntradaFifo *e) {
+    // Crear el FIFO si no existe
+    if (mkfifo(e->ruta, 0666) == -1) {
         if (errno != EEXIST) {
             perror("mkfifo");
-            return EXIT_FAILURE;
+            return -1;
         }
     }
 
-    int fdRead = open(pipeRecibePath, O_RDONLY);
-    if (fdRead == -1) {
+    // O_NONBLOCK: no esperar a que aparezca el primer agente por FIFO (las
+    // sesiones de socket deben atenderse mientras tanto)
+    e->fd = open(e->ruta, O_RDONLY | O_NONBLOCK);
+    if (e->fd == -1) {
         perror("open pipeRecibe (lectura)");
-        return EXIT_FAILURE;
+        return -1;
     }
     // Mantener un descriptor de escritura abierto para que read no devuelva EOF
-    int fdDummyWrite = open(pipeRecibePath, O_WRONLY);
-    if (fdDummyWrite == -1) {
+    e->fdDummy = open(e->ruta, O_WRONLY);
+    if (e->fdDummy == -1) {
         perror("open pipeRecibe (dummy escritura)");
-        close(fdRead);
-        return EXIT_FAILURE;
+        close(e->fd);
+        e->fd = -1;
+        return -1;
     }
+    return 0;
+}
 
-    FILE *fp = fdopen(fdRead, "r");
-    if (!fp) {
-        perror("fdopen");
-        close(fdRead);
-        close(fdDummyWrite);
-        return EXIT_FAILURE;
+static int abrir_socket_escucha(void) {
+    // Cada sesion ocupa un descriptor: subir el limite blando hasta el duro
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
     }
 
-    pthread_t thrReloj;
-    if (pthread_create(&thrReloj, NULL, hilo_reloj, NULL) != 0) {
-        perror("pthread_create");
-        fclose(fp);
-        close(fdDummyWrite);
-        return EXIT_FAILURE;
+    int fd = socket(AF_UNIX, TIPO_SOCKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.sun_family = AF_UNIX;
+    memcpy(dir.sun_path, socketPath, strlen(socketPath) + 1); // largo validado en parse_args
+
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr *)&dir, sizeof(dir)) == -1) {
+        perror("bind socket");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) == -1) {
+        perror("listen socket");
+        close(fd);
+        unlink(socketPath);
+        return -1;
     }
+    return fd;
+}
 
-    char linea[MAX_LINE_LEN];
+// El agente cerro su sesion (o se fue sin cerrarla).
+static void cerrar_sesion_agente(Fragmento *f, int idx) {
+    texto_printf(&f->texto, "Sesion cerrada por el agente (%d agente(s) registrados en ella).\n",
+                 f->conexiones[idx].numAgentes);
+    grabar_traza(f, TRAZA_SESION_CIERRA, idx, 0, NULL, 0);
+    cerrar_sesion(f, idx);
+}
+
+// El socket de escucha lo vigilan todos los fragmentos; cada sesion queda en
+// el que la acepto.
+static void aceptar_sesiones(Fragmento *f) {
     while (1) {
-        if (!fgets(linea, sizeof(linea), fp)) {
-            if (feof(fp)) {
-                clearerr(fp);
-                continue;
-            } else {
-                perror("fgets");
+        int fd = accept(fdEscucha, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        int idx = abrir_sesion(f, fd);
+        if (idx != -1) {
+            grabar_traza(f, TRAZA_SESION_ABRE, idx, 0, NULL, 0);
+        } else {
+            close(fd);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Hilos de los fragmentos
+// ---------------------------------------------------------------------------
+
+static void grabar_solicitud(Fragmento *f, const Solicitud *s) {
+    if (!f->trazaSalida) return;
+    char datos[sizeof(DatosSolicitud) + MAX_LINE_LEN];
+    DatosSolicitud d = {s->parque, s->origen, s->agente, s->rechazada};
+    size_t largo = strlen(s->linea);
+    memcpy(datos, &d, sizeof(d));
+    memcpy(datos + sizeof(d), s->linea, largo);
+    grabar_traza(f, TRAZA_SOLICITUD, -1, 0, datos, sizeof(d) + largo);
+}
+
+static void grabar_respuesta(Fragmento *f, const Respuesta *r) {
+    if (!f->trazaSalida) return;
+    char datos[sizeof(uint32_t) + MAX_RESPUESTA_LEN];
+    size_t largo = strlen(r->texto);
+    memcpy(datos, &r->generacion, sizeof(r->generacion));
+    memcpy(datos + sizeof(r->generacion), r->texto, largo);
+    grabar_traza(f, TRAZA_RESPUESTA, r->conexion, r->turno, datos,
+                 sizeof(r->generacion) + largo);
+}
+
+// Atiende lo que dejaron los demas fragmentos: REQ para sus parques y
+// respuestas y avisos para sus agentes, cada uno grabado al tomarlo.
+static void atender_bandeja(Fragmento *f) {
+    LoteMensajes *l = &f->enProceso;
+    pthread_mutex_lock(&f->mutexBandeja);
+    lote_intercambiar(&f->bandeja, l);
+    pthread_mutex_unlock(&f->mutexBandeja);
+
+    for (int i = 0; i < l->num; ++i) {
+        Mensaje *m = &l->mensajes[i];
+        switch (m->tipo) {
+            case MENSAJE_SOLICITUD:
+                grabar_solicitud(f, &m->solicitud);
+                procesar_solicitud_reserva(f, &m->solicitud);
+                break;
+            case MENSAJE_RESPUESTA:
+                grabar_respuesta(f, &m->respuesta);
+                entregar_respuesta(f, m->respuesta.conexion, m->respuesta.generacion,
+                                   m->respuesta.turno, m->respuesta.texto);
+                if (atomic_fetch_sub(&turnosEnVuelo, 1) == 1 &&
+                    atomic_load(&fragmentosCerrando) == numFragmentos) {
+                    despertar_todos();
+                }
                 break;
+            case MENSAJE_AVISOS:
+                recibir_avisos_remotos(f, m->avisos.nodos, m->avisos.numNodos);
+                free(m->avisos.nodos);
+                break;
+        }
+        f->mensajes++;
+    }
+    l->num = 0;
+}
+
+static void *hilo_fragmento(void *arg) {
+    Fragmento *f = (Fragmento *)arg;
+    struct pollfd *pfds = f->pfds;
+    int *idxPoll = f->idxPoll;
+
+    while (1) {
+        // El pipe para despertarlo siempre se vigila; sus FIFOs de entrada,
+        // el socket de escucha y las sesiones (salvo suspendidas) para lectura
+        // hasta que terminan todos los parques, y cualquier conexion para
+        // escritura solo si tiene datos pendientes y un fd abierto.
+        int n = 0;
+        pfds[n].fd = f->pipeDespertar[0];
+        pfds[n].events = POLLIN;
+        n++;
+        int primeraEntrada = n;
+        for (int k = 0; k < f->numEntradas && !f->cerrando; ++k) {
+            if (f->entradas[k].fd == -1) continue;
+            pfds[n].fd = f->entradas[k].fd;
+            pfds[n].events = POLLIN;
+            idxPoll[n] = k;
+            n++;
+        }
+        int finEntradas = n;
+        int posEscucha = -1;
+        if (fdEscucha != -1 && !f->cerrando) {
+            posEscucha = n;
+            pfds[n].fd = fdEscucha;
+            pfds[n].events = POLLIN;
+            n++;
+        }
+        int primera = n;
+        for (int i = 0; i < f->numConexiones; ++i) {
+            Conexion *c = &f->conexiones[i];
+            if (!c->enUso || c->fd == -1) continue;
+            short eventos = c->tipo == CONEXION_SOCKET && c->estado != CONEXION_SUSPENDIDA &&
+                            !f->cerrando ? POLLIN : 0;
+            if (c->cola.len > 0) eventos |= POLLOUT;
+            if (eventos == 0) continue;
+            pfds[n].fd = c->fd;
+            pfds[n].events = eventos;
+            idxPoll[n] = i;
+            n++;
+        }
+
+        if (poll(pfds, (nfds_t)n, espera_poll(f)) == -1) {
+            if (errno != EINTR) perror("poll");
+            for (int k = 0; k < n; ++k) pfds[k].revents = 0;
+        }
+        for (int k = primeraEntrada; k < finEntradas; ++k) {
+            if (pfds[k].revents & POLLIN) {
+                EntradaFifo *e = &f->entradas[idxPoll[k]];
+                leer_entrada(f, e->fd, &e->buf, -1, -1 - idxPoll[k]);
             }
         }
-        manejar_linea_mensaje(linea);
+        for (int k = primera; k < n; ++k) {
+            int idx = idxPoll[k];
+            Conexion *c = &f->conexiones[idx];
+            // Una linea anterior pudo cerrar esta conexion
+            if (!c->enUso || c->fd != pfds[k].fd || pfds[k].revents == 0) continue;
+
+            if (c->tipo == CONEXION_FIFO) {
+                if (pfds[k].revents & (POLLERR | POLLHUP)) {
+                    cerrar_fd_conexion(c);
+                }
+            } else if (!(pfds[k].events & POLLIN)) {
+                // Sin POLLIN solo llega aqui por POLLOUT o porque el agente se fue
+                if (pfds[k].revents & (POLLERR | POLLHUP)) {
+                    cerrar_sesion_agente(f, idx);
+                }
+            } else if (pfds[k].revents & (POLLIN | POLLERR | POLLHUP)) {
+                if (leer_entrada(f, c->fd, c->entrada, idx, idx) == 1) {
+                    cerrar_sesion_agente(f, idx);
+                }
+            }
+        }
+        if (posEscucha != -1 && (pfds[posEscucha].revents & POLLIN)) {
+            aceptar_sesiones(f);
+        }
+        if (pfds[0].revents & POLLIN) {
+            // Solo despierta: la bandeja se atiende abajo
+            char basura[64];
+            while (read(f->pipeDespertar[0], basura, sizeof(basura)) > 0) {
+            }
+        }
+
+        // Los avisos van detras de las respuestas ya encoladas. Ademas de los
+        // que poll marco como escribibles, se intenta con todos los que tengan
+        // pendientes: respuestas recien encoladas y FIFOs que aun no tenian
+        // lector.
+        atender_bandeja(f);
+        int terminados = avanzar_horas_vencidas(f);
+        enviar_avisos_pendientes(f);
+        vaciar_colas_pendientes(f);
+        if (!f->cerrando) reanudar_conexiones_suspendidas(f);
+        // Los ENTER de lo que admitio reanudar, y lo de esta vuelta para los
+        // demas fragmentos
+        enviar_avisos_pendientes(f);
+        publicar_mensajes(f);
+        volcar_texto(&f->texto);
+
+        // Un parque cuenta como terminado despues de publicar los avisos de
+        // su ultima hora; cuando terminaron todos, cada fragmento deja de leer
+        // y sale cuando los demas tambien dejaron y no queda ninguna REQ
+        // reenviada sin contestar.
+        if (terminados > 0 &&
+            atomic_fetch_add(&parquesTerminados, terminados) + terminados == numParques) {
+            despertar_todos();
+        }
+        if (!f->cerrando && atomic_load(&parquesTerminados) == numParques) {
+            f->cerrando = 1;
+            if (atomic_fetch_add(&fragmentosCerrando, 1) + 1 == numFragmentos) {
+                despertar_todos();
+            }
+        }
+        if (f->cerrando && atomic_load(&fragmentosCerrando) == numFragmentos &&
+            atomic_load(&turnosEnVuelo) == 0) {
+            atender_bandeja(f);
+            enviar_avisos_pendientes(f);
+            grabar_traza(f, TRAZA_FIN, -1, 0, NULL, 0);
+            notificar_fin_a_agentes(f);
+            break;
+        }
+    }
+
+    drenar_colas(f, DRENADO_FIN_MS);
+    volcar_texto(&f->texto);
+    cerrar_traza(f);
+    for (int i = 0; i < f->numConexiones; ++i) {
+        if (f->conexiones[i].enUso) cerrar_fd_conexion(&f->conexiones[i]);
+    }
+    return NULL;
+}
 
-        pthread_mutex_lock(&mutexDatos);
-        int fin = simulacionTerminada;
-        pthread_mutex_unlock(&mutexDatos);
-        if (fin) {
+// ---------------------------------------------------------------------------
+// Reproduccion de trazas (-R)
+//
+// Aplica los registros de la traza de un fragmento en orden, sin FIFOs,
+// sockets ni esperas: lo leido pasa por recibir_entrada y
+// manejar_linea_mensaje como en la ejecucion grabada, lo que llego de otros
+// fragmentos se toma de sus registros y lo que admitio cada agente sale de
+// los registros de escritura. Las decisiones (incluidas suspensiones y
+// desconexiones) y el reporte de sus parques son los mismos; cada traza se
+// reproduce en su propio hilo y el tiempo empleado sirve como medida de
+// rendimiento de la admision con trafico real.
+// ---------------------------------------------------------------------------
+
+// Abre una traza y valida su cabecera. La primera define la tabla de parques
+// y el reparto en fragmentos; las demas deben ser de la misma ejecucion.
+static int abrir_traza(const char *ruta) {
+    FILE *t = fopen(ruta, "rb");
+    if (!t) {
+        perror("fopen traza");
+        return -1;
+    }
+    setvbuf(t, NULL, _IOFBF, 64 * 1024);
+    CabeceraTraza cab;
+    if (fread(&cab, sizeof(cab), 1, t) != 1 || cab.magic != TRAZA_MAGIC ||
+        cab.version != TRAZA_VERSION) {
+        fprintf(stderr, "Formato de traza no soportado: %s\n", ruta);
+        fclose(t);
+        return -1;
+    }
+    int primera = numParques == 0;
+    int valida = cab.limiteCola != 0 &&
+                 (cab.politica == POLITICA_SUSPENDER || cab.politica == POLITICA_DESCONECTAR) &&
+                 cab.numParques > 0 && cab.numParques <= MAX_PARQUES &&
+                 cab.numFragmentos > 0 && cab.numFragmentos <= cab.numParques &&
+                 cab.fragmento >= 0 && cab.fragmento < cab.numFragmentos;
+    if (valida && !primera) {
+        valida = cab.limiteCola == limiteColaSalida && cab.politica == (int32_t)politicaLento &&
+                 cab.numParques == numParques && cab.numFragmentos == fragmentosPedidos;
+    }
+    for (int i = 0; valida && i < cab.numParques; ++i) {
+        ParqueTraza pt;
+        if (fread(&pt, sizeof(pt), 1, t) != 1) {
+            valida = 0;
             break;
         }
+        pt.id[sizeof(pt.id) - 1] = '\0';
+        if (pt.fragmento != i % cab.numFragmentos) {
+            valida = 0;
+        } else if (primera) {
+            valida = validar_parque(pt.id, pt.horaIni, pt.horaFin, pt.segHoras, pt.aforo) == 0 &&
+                     agregar_parque(pt.id, pt.horaIni, pt.horaFin, pt.segHoras, pt.aforo);
+        } else {
+            const Parque *p = &parques[i];
+            valida = strcmp(pt.id, p->id) == 0 && pt.horaIni == p->horaIni &&
+                     pt.horaFin == p->horaFin && pt.segHoras == p->segHoras &&
+                     pt.aforo == p->aforo;
+        }
+    }
+    if (!valida || fragmentos[cab.fragmento].trazaEntrada) {
+        fprintf(stderr, "Cabecera de traza invalida o de otra ejecucion: %s\n", ruta);
+        fclose(t);
+        return -1;
+    }
+    if (primera) {
+        limiteColaSalida = cab.limiteCola;
+        politicaLento = (PoliticaLento)cab.politica;
+        fragmentosPedidos = cab.numFragmentos;
     }
+    fragmentos[cab.fragmento].trazaEntrada = t;
+    return 0;
+}
 
-    pthread_join(thrReloj, NULL);
+// Buffer de entrada del FIFO o de la sesion del registro, o NULL si no
+// corresponde.
+static BufferEntrada *entrada_grabada(Fragmento *f, const RegistroTraza *r) {
+    if (r->conexion < 0) {
+        int k = -1 - r->conexion;
+        return k < f->numEntradas ? &f->entradas[k].buf : NULL;
+    }
+    if (r->conexion >= f->numConexiones) return NULL;
+    Conexion *c = &f->conexiones[r->conexion];
+    return c->enUso && c->tipo == CONEXION_SOCKET ? c->entrada : NULL;
+}
 
-    notificar_fin_a_agentes();
-    imprimir_reporte_final();
+// Parque propio nombrado por el registro, o NULL.
+static Parque *parque_grabado(Fragmento *f, int indice) {
+    if (indice < 0 || indice >= numParques || parques[indice].fragmento != f) return NULL;
+    return &parques[indice];
+}
 
-    fclose(fp);
-    close(fdDummyWrite);
+static int solicitud_grabada(Fragmento *f, const RegistroTraza *r, const char *datos,
+                             Solicitud *s) {
+    DatosSolicitud d;
+    if (r->largo <= sizeof(d) || r->largo - sizeof(d) >= MAX_LINE_LEN) return -1;
+    memcpy(&d, datos, sizeof(d));
+    if (!parque_grabado(f, d.parque) || d.origen < 0 || d.origen >= numFragmentos ||
+        d.origen == f->id) {
+        return -1;
+    }
+    s->parque = d.parque;
+    s->origen = d.origen;
+    s->agente = d.agente;
+    s->conexion = -1;
+    s->generacion = 0;
+    s->turno = 0;
+    s->rechazada = d.rechazada;
+    memcpy(s->linea, datos + sizeof(d), r->largo - sizeof(d));
+    s->linea[r->largo - sizeof(d)] = '\0';
+    // Se valido al recibirla: debe tener agente, familia, hora y personas
+    char copia[MAX_LINE_LEN];
+    memcpy(copia, s->linea, sizeof(copia));
+    char *campos[MAX_CAMPOS];
+    return separar_campos(copia, campos, MAX_CAMPOS) >= 5 ? 0 : -1;
+}
 
-    return EXIT_SUCCESS;
+static void reproducir_traza(Fragmento *f) {
+    RegistroTraza r;
+    char *datos = f->datosTraza;
+    int error = 0;
+    int lr;
+
+    while (!error && (lr = leer_registro_traza(f, &r, datos, TRAZA_MAX_DATOS)) == 1) {
+        switch (r.tipo) {
+            case TRAZA_HORA: {
+                Parque *p = parque_grabado(f, r.conexion);
+                if (!p || r.valor != (uint32_t)p->horaActual + 1 || (int)r.valor > p->horaFin) {
+                    fprintf(stderr, "Traza inconsistente: hora %u del parque %d "
+                            "(registro %u).\n", r.valor, r.conexion, r.secuencia);
+                    error = 1;
+                    break;
+                }
+                avanzar_hora(f, p, (int)r.valor);
+                break;
+            }
+            case TRAZA_LECTURA: {
+                BufferEntrada *b = entrada_grabada(f, &r);
+                if (!b || b->len + r.largo >= sizeof(b->datos)) {
+                    fprintf(stderr, "Traza inconsistente: lectura de la conexion %d "
+                            "(registro %u).\n", r.conexion, r.secuencia);
+                    error = 1;
+                    break;
+                }
+                memcpy(b->datos + b->len, datos, r.largo);
+                recibir_entrada(f, b, r.largo, r.conexion < 0 ? -1 : r.conexion);
+                break;
+            }
+            case TRAZA_SESION_ABRE:
+                if (abrir_sesion(f, -1) != r.conexion) {
+                    fprintf(stderr, "Traza inconsistente: la sesion no ocupa la conexion %d "
+                            "(registro %u).\n", r.conexion, r.secuencia);
+                    error = 1;
+                }
+                break;
+            case TRAZA_SESION_CIERRA:
+            case TRAZA_ESCRITURA:
+            case TRAZA_ESCRITURA_FIN:
+            case TRAZA_REANUDA:
+                if (r.conexion < 0 || r.conexion >= f->numConexiones ||
+                    !f->conexiones[r.conexion].enUso) {
+                    fprintf(stderr, "Traza inconsistente: conexion %d inexistente "
+                            "(registro %u).\n", r.conexion, r.secuencia);
+                    error = 1;
+                } else if (r.tipo == TRAZA_SESION_CIERRA) {
+                    cerrar_sesion_agente(f, r.conexion);
+                } else if (r.tipo == TRAZA_REANUDA) {
+                    reanudar_conexion(f, r.conexion);
+                } else {
+                    devolver_registro_traza(f, &r);
+                    vaciar_cola_conexion(f, &f->conexiones[r.conexion]);
+                }
+                break;
+            case TRAZA_AVISOS:
+                enviar_avisos_pendientes(f);
+                break;
+            case TRAZA_SOLICITUD: {
+                Solicitud s;
+                if (solicitud_grabada(f, &r, datos, &s) != 0) {
+                    fprintf(stderr, "Traza inconsistente: solicitud invalida "
+                            "(registro %u).\n", r.secuencia);
+                    error = 1;
+                    break;
+                }
+                procesar_solicitud_reserva(f, &s);
+                f->mensajes++;
+                break;
+            }
+            case TRAZA_RESPUESTA: {
+                uint32_t generacion;
+                char texto[MAX_RESPUESTA_LEN];
+                if (r.largo < sizeof(generacion) ||
+                    r.largo - sizeof(generacion) >= sizeof(texto)) {
+                    fprintf(stderr, "Traza inconsistente: respuesta invalida "
+                            "(registro %u).\n", r.secuencia);
+                    error = 1;
+                    break;
+                }
+                memcpy(&generacion, datos, sizeof(generacion));
+                memcpy(texto, datos + sizeof(generacion), r.largo - sizeof(generacion));
+                texto[r.largo - sizeof(generacion)] = '\0';
+                entregar_respuesta(f, r.conexion, generacion, r.valor, texto);
+                f->mensajes++;
+                break;
+            }
+            case TRAZA_AVISOS_REMOTOS:
+                if (reproducir_avisos_remotos(f, datos, r.largo) != 0) {
+                    fprintf(stderr, "Traza inconsistente: avisos invalidos "
+                            "(registro %u).\n", r.secuencia);
+                    error = 1;
+                }
+                f->mensajes++;
+                break;
+            case TRAZA_FIN:
+                notificar_fin_a_agentes(f);
+                break;
+            default:
+                fprintf(stderr, "Registro de traza invalido (registro %u).\n", r.secuencia);
+                error = 1;
+        }
+        if (f->texto.len >= 64 * 1024) volcar_texto(&f->texto);
+    }
+    if (!error && lr == -1) {
+        fprintf(stderr, "Registro de traza incompleto tras el registro %u.\n",
+                r.secuencia);
+        error = 1;
+    }
+
+    // Una traza cortada (controlador interrumpido) se completa hasta horaFin
+    for (int i = 0; !error && i < f->numParques; ++i) {
+        Parque *p = f->parques[i];
+        while (p->horaActual < p->horaFin) {
+            avanzar_hora(f, p, p->horaActual + 1);
+        }
+    }
+    volcar_texto(&f->texto);
+    f->errorReproduccion = error || f->trazaInconsistente;
+}
+
+static void *hilo_reproduccion(void *arg) {
+    reproducir_traza((Fragmento *)arg);
+    return NULL;
+}
+
+static int reproducir_trazas(void) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int k = 0; k < numFragmentos; ++k) {
+        Fragmento *f = &fragmentos[k];
+        if (f->activo && pthread_create(&f->hilo, NULL, hilo_reproduccion, f) != 0) {
+            perror("pthread_create");
+            f->activo = 0;
+            f->errorReproduccion = 1;
+        }
+    }
+    long mensajes = 0;
+    int error = 0;
+    for (int k = 0; k < numFragmentos; ++k) {
+        Fragmento *f = &fragmentos[k];
+        if (f->activo) {
+            pthread_join(f->hilo, NULL);
+            mensajes += f->mensajes;
+        }
+        error |= f->errorReproduccion;
+    }
+
+    long ms = ms_desde(&t0);
+    fprintf(stderr, "Reproduccion: %ld mensajes de %d traza(s) en %ld ms", mensajes,
+            numTrazasReproducir, ms);
+    if (ms > 0) {
+        fprintf(stderr, " (%.0f mensajes/s)", mensajes * 1000.0 / ms);
+    }
+    fprintf(stderr, "\n");
+    return error ? -1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Arranque
+// ---------------------------------------------------------------------------
+
+// Reparte los parques en fragmentos (por turno) y prepara lo de cada uno: sus
+// tablas y sus FIFOs de entrada. El FIFO de -p lo atiende el fragmento del
+// primer parque; con -k cada parque tiene ademas el suyo, ruta.id, en el
+// fragmento que lo atiende. Los FIFOs se abren aparte, para que la
+// reproduccion use la misma estructura.
+static int crear_fragmentos(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    numFragmentos = fragmentosPedidos > 0 ? fragmentosPedidos : (cpus > 0 ? (int)cpus : 1);
+    if (numFragmentos > numParques) numFragmentos = numParques;
+
+    for (int i = 0; i < numParques; ++i) {
+        Fragmento *f = &fragmentos[i % numFragmentos];
+        f->parques[f->numParques++] = &parques[i];
+        parques[i].fragmento = f;
+    }
+    for (int k = 0; k < numFragmentos; ++k) {
+        Fragmento *f = &fragmentos[k];
+        f->id = k;
+        f->activo = !reproduciendo || f->trazaEntrada != NULL;
+        f->pipeDespertar[0] = f->pipeDespertar[1] = -1;
+        f->entradas = calloc((size_t)f->numParques + 1, sizeof(*f->entradas));
+        f->agentes = calloc(MAX_AGENTS, sizeof(*f->agentes));
+        f->indiceAgentes = calloc(TABLA_AGENTES, sizeof(*f->indiceAgentes));
+        f->conexiones = calloc(MAX_CONEXIONES, sizeof(*f->conexiones));
+        f->tocadas = calloc(MAX_CONEXIONES, sizeof(*f->tocadas));
+        size_t maxPoll = (size_t)f->numParques + 3 + MAX_CONEXIONES;
+        f->pfds = calloc(maxPoll, sizeof(*f->pfds));
+        f->idxPoll = calloc(maxPoll, sizeof(*f->idxPoll));
+        f->datosTraza = malloc(TRAZA_MAX_DATOS);
+        if (!f->entradas || !f->agentes || !f->indiceAgentes || !f->conexiones ||
+            !f->tocadas || !f->pfds || !f->idxPoll || !f->datosTraza ||
+            pthread_mutex_init(&f->mutexBandeja, NULL) != 0) {
+            fprintf(stderr, "No se pudo preparar el fragmento %d.\n", k);
+            return -1;
+        }
+        for (int i = 0; i < f->numParques; ++i) {
+            Parque *p = f->parques[i];
+            if (p->indice == 0) {
+                snprintf(f->entradas[f->numEntradas++].ruta, sizeof(f->entradas[0].ruta), "%s",
+                         pipeRecibePath);
+            }
+            if (p->id[0] != '\0') {
+                ruta_de_parque(f->entradas[f->numEntradas++].ruta, sizeof(f->entradas[0].ruta),
+                               pipeRecibePath, p);
+            }
+        }
+        for (int i = 0; i < f->numEntradas; ++i) {
+            f->entradas[i].fd = -1;
+            f->entradas[i].fdDummy = -1;
+        }
+    }
+    return 0;
+}
+
+// Publica la hora inicial de cada parque y abre sus archivos de ocupacion (-m).
+static int preparar_parques(void) {
+    for (int i = 0; i < numParques; ++i) {
+        Parque *p = &parques[i];
+        char ruta[256];
+        if (archivoOcupacionPath[0] != '\0') {
+            ruta_de_parque(ruta, sizeof(ruta), archivoOcupacionPath, p);
+        }
+        if (crear_archivo_ocupacion(p, archivoOcupacionPath[0] != '\0' ? ruta : NULL) != 0) {
+            return -1;
+        }
+        publicar_tick(p, p->horaActual);
+    }
+    return 0;
+}
+
+// Traza de cada fragmento (-r): la ruta tal cual con un solo fragmento,
+// ruta.N con varios.
+static int crear_trazas(void) {
+    for (int k = 0; k < numFragmentos; ++k) {
+        char ruta[160];
+        if (numFragmentos == 1) {
+            snprintf(ruta, sizeof(ruta), "%s", trazaGrabarPath);
+        } else {
+            snprintf(ruta, sizeof(ruta), "%.127s.%d", trazaGrabarPath, k);
+        }
+        if (crear_traza(&fragmentos[k], ruta) != 0) return -1;
+    }
+    return 0;
+}
+
+// FIFOs de entrada (con -p) y pipe para despertar a cada fragmento.
+static int abrir_entradas(void) {
+    for (int k = 0; k < numFragmentos; ++k) {
+        Fragmento *f = &fragmentos[k];
+        if (pipe(f->pipeDespertar) == -1) {
+            perror("pipe despertar");
+            f->pipeDespertar[0] = f->pipeDespertar[1] = -1;
+            return -1;
+        }
+        for (int i = 0; i < 2; ++i) {
+            fcntl(f->pipeDespertar[i], F_SETFL, fcntl(f->pipeDespertar[i], F_GETFL) | O_NONBLOCK);
+            fcntl(f->pipeDespertar[i], F_SETFD, FD_CLOEXEC);
+        }
+        for (int i = 0; pipeRecibePath[0] != '\0' && i < f->numEntradas; ++i) {
+            if (abrir_fifo_entrada(&f->entradas[i]) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static void cerrar_entradas(void) {
+    for (int k = 0; k < numFragmentos; ++k) {
+        Fragmento *f = &fragmentos[k];
+        for (int i = 0; i < f->numEntradas; ++i) {
+            if (f->entradas[i].fd != -1) close(f->entradas[i].fd);
+            if (f->entradas[i].fdDummy != -1) close(f->entradas[i].fdDummy);
+        }
+        if (f->pipeDespertar[0] != -1) {
+            close(f->pipeDespertar[0]);
+            close(f->pipeDespertar[1]);
+        }
+    }
+    if (fdEscucha != -1) {
+        close(fdEscucha);
+        unlink(socketPath);
+    }
 }
 
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    ventana_iniciar();
+
+    for (int i = 0; i < numTrazasReproducir; ++i) {
+        reproduciendo = 1;
+        if (abrir_traza(trazasReproducir[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (crear_fragmentos() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (parques[0].id[0] == '\0') {
+        printf("Controlador iniciado. SimulaciaIn de %d a %d, aforo=%d, segHoras=%d\n",
+               parques[0].horaIni, parques[0].horaFin, parques[0].aforo, parques[0].segHoras);
+    } else {
+        printf("Controlador iniciado. %d parques en %d fragmentos\n", numParques,
+               numFragmentos);
+        for (int i = 0; i < numParques; ++i) {
+            printf("  %sSimulaciaIn de %d a %d, aforo=%d, segHoras=%d\n", parques[i].prefijo,
+                   parques[i].horaIni, parques[i].horaFin, parques[i].aforo,
+                   parques[i].segHoras);
+        }
+    }
+
+    if (preparar_parques() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Desde aqui cada hilo escribe en stdout con su propio buffer
+    fflush(stdout);
+
+    if (reproduciendo) {
+        int r = reproducir_trazas();
+        for (int k = 0; k < numFragmentos; ++k) {
+            if (fragmentos[k].trazaEntrada) fclose(fragmentos[k].trazaEntrada);
+        }
+        imprimir_reportes();
+        return r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (trazaGrabarPath[0] != '\0' && crear_trazas() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Un agente que cierra su FIFO o socket no debe terminar el controlador
+    signal(SIGPIPE, SIG_IGN);
+
+    if (abrir_entradas() != 0) {
+        cerrar_entradas();
+        return EXIT_FAILURE;
+    }
+    if (socketPath[0] != '\0') {
+        fdEscucha = abrir_socket_escucha();
+        if (fdEscucha == -1) {
+            cerrar_entradas();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Todos los relojes parten del mismo instante
+    struct timespec inicio;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    for (int i = 0; i < numParques; ++i) {
+        parques[i].proximaHora = inicio;
+        sumar_segundos(&parques[i].proximaHora, parques[i].segHoras);
+    }
+    for (int k = 0; k < numFragmentos; ++k) {
+        if (pthread_create(&fragmentos[k].hilo, NULL, hilo_fragmento, &fragmentos[k]) != 0) {
+            // Los ya creados esperarian a este para terminar
+            perror("pthread_create");
+            cerrar_entradas();
+            return EXIT_FAILURE;
+        }
+    }
+    for (int k = 0; k < numFragmentos; ++k) {
+        pthread_join(fragmentos[k].hilo, NULL);
+    }
 
+    imprimir_reportes();
+    cerrar_entradas();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ocupacion.h"
+
+// Lector del archivo de ocupacion publicado por el controlador (-m).
+// No se comunica con el controlador: solo mapea el archivo en modo lectura.
+
+typedef struct {
+    char archivo[256];
+    int intervaloMs;   // 0: una sola lectura
+    int historial;
+} ConfigMonitor;
+
+static void uso(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s -m archivoOcupacion [-i intervaloMs] [-H]\n",
+            prog);
+}
+
+static int parse_args(int argc, char *argv[], ConfigMonitor *cfg) {
+    int opt;
+    int got_m = 0;
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    while ((opt = getopt(argc, argv, "m:i:H")) != -1) {
+        switch (opt) {
+            case 'm':
+                strncpy(cfg->archivo, optarg, sizeof(cfg->archivo) - 1);
+                cfg->archivo[sizeof(cfg->archivo) - 1] = '\0';
+                got_m = 1;
+                break;
+            case 'i':
+                cfg->intervaloMs = atoi(optarg);
+                break;
+            case 'H':
+                cfg->historial = 1;
+                break;
+            default:
+                uso(argv[0]);
+                return -1;
+        }
+    }
+
+    if (!got_m || cfg->intervaloMs < 0) {
+        uso(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static const ArchivoOcupacion *mapear(const char *ruta) {
+    int fd = open(ruta, O_RDONLY);
+    if (fd == -1) {
+        perror("open archivo de ocupacion");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(ArchivoOcupacion)) {
+        fprintf(stderr, "Archivo de ocupacion incompleto: %s\n", ruta);
+        close(fd);
+        return NULL;
+    }
+    void *m = mmap(NULL, sizeof(ArchivoOcupacion), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        perror("mmap archivo de ocupacion");
+        return NULL;
+    }
+
+    const ArchivoOcupacion *a = (const ArchivoOcupacion *)m;
+    if (a->magic != OCUPACION_MAGIC || a->version != OCUPACION_VERSION ||
+        a->tamano != sizeof(ArchivoOcupacion)) {
+        fprintf(stderr, "Formato de archivo de ocupacion no soportado: %s\n", ruta);
+        munmap(m, sizeof(ArchivoOcupacion));
+        return NULL;
+    }
+    return a;
+}
+
+static void imprimir_estado(const ArchivoOcupacion *a, const EstadoOcupacion *e) {
+    printf("Hora actual: %d%s (aforo=%d)\n", e->horaActual,
+           e->terminada ? " [simulacion terminada]" : "", a->aforo);
+    printf("  Hora  Ocupacion  Entran  Salen\n");
+    for (int h = a->horaIni; h <= a->horaFin; ++h) {
+        printf("  %4d  %9d  %6d  %5d%s\n", h, e->personasPorHora[h],
+               e->entranPorHora[h], e->salenPorHora[h],
+               h == e->horaActual ? "  <-" : "");
+    }
+    printf("  Negadas=%d AceptadasExactas=%d Reprogramadas=%d\n",
+           e->negadas, e->aceptadasExactas, e->reprogramadas);
+}
+
+static void imprimir_historial(const ArchivoOcupacion *a) {
+    ArchivoOcupacion *m = (ArchivoOcupacion *)a;
+    uint32_t n = atomic_load_explicit(&m->numTicks, memory_order_acquire);
+    if (n > OCUPACION_MAX_TICKS) n = OCUPACION_MAX_TICKS;
+
+    printf("Historial (%u ticks):\n", n);
+    printf("  Hora  Ocupacion  Entran  Salen  Negadas  Exactas  Reprog\n");
+    for (uint32_t i = 0; i < n; ++i) {
+        const RegistroTick *t = &a->historial[i];
+        printf("  %4d  %9d  %6d  %5d  %7d  %7d  %6d\n", t->hora, t->ocupacion,
+               t->entran, t->salen, t->negadas, t->aceptadasExactas,
+               t->reprogramadas);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    ConfigMonitor cfg;
+    if (parse_args(argc, argv, &cfg) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    const ArchivoOcupacion *a = mapear(cfg.archivo);
+    if (!a) {
+        return EXIT_FAILURE;
+    }
+
+    EstadoOcupacion e;
+    while (1) {
+        ocupacion_leer(a, &e);
+        imprimir_estado(a, &e);
+        if (cfg.historial) {
+            imprimir_historial(a);
+        }
+        fflush(stdout);
+
+        if (cfg.intervaloMs == 0 || e.terminada) {
+            break;
+        }
+        struct timespec espera = {cfg.intervaloMs / 1000,
+                                  (long)(cfg.intervaloMs % 1000) * 1000000L};
+        nanosleep(&espera, NULL);
+        printf("\n");
+    }
+
+    munmap((void *)a, sizeof(ArchivoOcupacion));
+    return EXIT_SUCCESS;
+}
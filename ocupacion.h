@@ -0,0 +1,86 @@
+#ifndef OCUPACION_H
+#define OCUPACION_H
+
+// Formato del archivo de ocupacion que publica el controlador (-m) y que
+// leen herramientas externas como monitor.
+//
+// Un unico escritor (el controlador) actualiza el bloque "actual" protegido
+// por un seqlock: incrementa secuencia (queda impar), escribe y la vuelve a
+// incrementar (queda par). Un lector copia el bloque y solo acepta la copia si
+// secuencia era par y no cambio mientras copiaba; no hay llamadas al sistema
+// ni bloqueos compartidos con la admision.
+//
+// El historial es de solo agregado: primero se escribe el registro y despues
+// se publica numTicks, asi que todo registro con indice < numTicks es estable.
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define OCUPACION_MAGIC 0x5055434fu // "OCUP"
+#define OCUPACION_VERSION 1
+#define OCUPACION_HORAS 25          // indices 0-24, se usan horaIni..horaFin
+#define OCUPACION_MAX_TICKS 1024
+
+typedef struct {
+    int32_t hora;
+    int32_t ocupacion;   // personas dentro del parque en esa hora
+    int32_t entran;      // personas que entran al iniciar la hora
+    int32_t salen;       // personas que salen al iniciar la hora
+    int32_t negadas;
+    int32_t aceptadasExactas;
+    int32_t reprogramadas;
+} RegistroTick;
+
+typedef struct {
+    int32_t horaActual;
+    int32_t terminada;
+    int32_t personasPorHora[OCUPACION_HORAS];
+    int32_t entranPorHora[OCUPACION_HORAS];
+    int32_t salenPorHora[OCUPACION_HORAS];
+    int32_t negadas;
+    int32_t aceptadasExactas;
+    int32_t reprogramadas;
+} EstadoOcupacion;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tamano;          // sizeof(ArchivoOcupacion) del escritor
+    int32_t horaIni;
+    int32_t horaFin;
+    int32_t aforo;
+
+    _Atomic uint32_t secuencia;
+    EstadoOcupacion actual;
+
+    _Atomic uint32_t numTicks;
+    RegistroTick historial[OCUPACION_MAX_TICKS];
+} ArchivoOcupacion;
+
+// Copia consistente de a->actual. Reintenta mientras haya una escritura en
+// curso; el escritor solo mantiene la secuencia impar durante unas decenas de
+// instrucciones.
+static inline void ocupacion_leer(const ArchivoOcupacion *a, EstadoOcupacion *dst) {
+    ArchivoOcupacion *m = (ArchivoOcupacion *)a;
+    while (1) {
+        uint32_t s1 = atomic_load_explicit(&m->secuencia, memory_order_acquire);
+        if (s1 & 1u) continue;
+        *dst = *(const volatile EstadoOcupacion *)&a->actual;
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t s2 = atomic_load_explicit(&m->secuencia, memory_order_relaxed);
+        if (s1 == s2) return;
+    }
+}
+
+static inline void ocupacion_escribir_inicio(ArchivoOcupacion *a) {
+    uint32_t s = atomic_load_explicit(&a->secuencia, memory_order_relaxed);
+    atomic_store_explicit(&a->secuencia, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void ocupacion_escribir_fin(ArchivoOcupacion *a) {
+    uint32_t s = atomic_load_explicit(&a->secuencia, memory_order_relaxed);
+    atomic_store_explicit(&a->secuencia, s + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "ventana.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VENTANA_X86 1
+#include <immintrin.h>
+#endif
+
+// Las versiones vectoriales comparan muchas franjas contra el limite por
+// instruccion y arman una mascara de 64 bits (bit i = franja i excedida). La
+// ventana se busca sobre esa mascara con operaciones de bits, arrastrando
+// entre bloques cuantas franjas libres seguidas habia al final del anterior.
+
+#define FRANJAS_BLOQUE 64
+
+static int ventana_buscar_escalar(const int32_t *ocupacion, int desde, int hasta,
+                                  int largo, int32_t limite) {
+    int racha = 0;
+    for (int i = desde; i < hasta; ++i) {
+        if (ocupacion[i] <= limite) {
+            if (++racha == largo) return i - largo + 1;
+        } else {
+            racha = 0;
+        }
+    }
+    return -1;
+}
+
+// Busca en un bloque de nbits franjas (base = indice de la primera) cuya
+// mascara de libres es "libres". *racha trae las franjas libres seguidas que
+// terminan justo antes del bloque y se actualiza para el siguiente.
+static inline int buscar_en_bloque(uint64_t libres, int nbits, int base, int largo,
+                                   int *racha) {
+    uint64_t todas = nbits == 64 ? ~0ull : (1ull << nbits) - 1;
+    libres &= todas;
+
+    // Ventana que empezo en bloques anteriores
+    int iniciales = libres == ~0ull ? 64 : __builtin_ctzll(~libres);
+    if (*racha + iniciales >= largo) return base - *racha;
+
+    // Ventana contenida en el bloque: tras el bucle el bit i queda en 1 solo
+    // si las franjas i .. i+largo-1 estan libres (se duplica lo cubierto en
+    // cada paso, log2(largo) desplazamientos)
+    if (largo <= nbits) {
+        uint64_t r = libres;
+        int cubierto = 1;
+        while (cubierto < largo) {
+            int d = cubierto < largo - cubierto ? cubierto : largo - cubierto;
+            r &= r >> d;
+            cubierto += d;
+        }
+        if (r) return base + __builtin_ctzll(r);
+    }
+
+    if (libres == todas) {
+        *racha += nbits;
+    } else {
+        // Franjas libres al final del bloque
+        *racha = __builtin_clzll(~(libres << (64 - nbits)));
+    }
+    return -1;
+}
+
+static inline uint64_t mascara_escalar(const int32_t *p, int n, int32_t limite) {
+    uint64_t m = 0;
+    for (int i = 0; i < n; ++i) {
+        m |= (uint64_t)(p[i] > limite) << i;
+    }
+    return m;
+}
+
+// Recorre [desde, hasta) por bloques completos con la mascara vectorial y
+// termina el resto con la escalar.
+#define DEFINIR_BUSQUEDA(nombre, mascara)                                        \
+    static int nombre(const int32_t *ocupacion, int desde, int hasta,            \
+                      int largo, int32_t limite) {                               \
+        int racha = 0;                                                           \
+        int i = desde;                                                           \
+        for (; i + FRANJAS_BLOQUE <= hasta; i += FRANJAS_BLOQUE) {               \
+            uint64_t libres = ~mascara(ocupacion + i, limite);                   \
+            int r = buscar_en_bloque(libres, FRANJAS_BLOQUE, i, largo, &racha);  \
+            if (r != -1) return r;                                               \
+        }                                                                        \
+        if (i < hasta) {                                                         \
+            uint64_t libres = ~mascara_escalar(ocupacion + i, hasta - i, limite); \
+            return buscar_en_bloque(libres, hasta - i, i, largo, &racha);        \
+        }                                                                        \
+        return -1;                                                               \
+    }
+
+#ifdef VENTANA_X86
+
+__attribute__((target("sse2")))
+static inline uint64_t mascara_sse2(const int32_t *p, int32_t limite) {
+    __m128i lim = _mm_set1_epi32(limite);
+    uint64_t m = 0;
+    for (int k = 0; k < FRANJAS_BLOQUE / 4; ++k) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 4 * k));
+        __m128i excede = _mm_cmpgt_epi32(v, lim);
+        m |= (uint64_t)(unsigned)_mm_movemask_ps(_mm_castsi128_ps(excede)) << (4 * k);
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t mascara_avx2(const int32_t *p, int32_t limite) {
+    __m256i lim = _mm256_set1_epi32(limite);
+    uint64_t m = 0;
+    for (int k = 0; k < FRANJAS_BLOQUE / 8; ++k) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 8 * k));
+        __m256i excede = _mm256_cmpgt_epi32(v, lim);
+        m |= (uint64_t)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(excede)) << (8 * k);
+    }
+    return m;
+}
+
+__attribute__((target("sse2")))
+DEFINIR_BUSQUEDA(ventana_buscar_sse2, mascara_sse2)
+
+__attribute__((target("avx2")))
+DEFINIR_BUSQUEDA(ventana_buscar_avx2, mascara_avx2)
+
+#endif
+
+static ImplementacionVentana implementaciones[3];
+static int numImplementaciones = 0;
+static FuncVentana implementacion = ventana_buscar_escalar;
+
+static void detectar_implementaciones(void) {
+    if (numImplementaciones > 0) return;
+    implementaciones[numImplementaciones++] =
+        (ImplementacionVentana){"escalar", ventana_buscar_escalar};
+#ifdef VENTANA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        implementaciones[numImplementaciones++] =
+            (ImplementacionVentana){"sse2", ventana_buscar_sse2};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        implementaciones[numImplementaciones++] =
+            (ImplementacionVentana){"avx2", ventana_buscar_avx2};
+    }
+#endif
+}
+
+const char *ventana_iniciar(void) {
+    detectar_implementaciones();
+    const ImplementacionVentana *elegida = &implementaciones[numImplementaciones - 1];
+    implementacion = elegida->buscar;
+    return elegida->nombre;
+}
+
+int ventana_buscar(const int32_t *ocupacion, int desde, int hasta, int largo,
+                   int32_t limite) {
+    return implementacion(ocupacion, desde, hasta, largo, limite);
+}
+
+int ventana_implementaciones(const ImplementacionVentana **lista) {
+    detectar_implementaciones();
+    *lista = implementaciones;
+    return numImplementaciones;
+}
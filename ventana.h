@@ -0,0 +1,33 @@
+#ifndef VENTANA_H
+#define VENTANA_H
+
+// Busqueda de la primera ventana de "largo" franjas consecutivas, empezando
+// en desde o despues y terminando antes de hasta (exclusivo), en la que cada
+// franja tiene ocupacion <= limite. Para admitir p personas con aforo A se usa
+// limite = A - p.
+//
+// Devuelve el indice de la primera franja de la ventana, o -1 si no hay.
+// Requiere largo >= 1.
+
+#include <stdint.h>
+
+typedef int (*FuncVentana)(const int32_t *ocupacion, int desde, int hasta,
+                           int largo, int32_t limite);
+
+typedef struct {
+    const char *nombre;
+    FuncVentana buscar;
+} ImplementacionVentana;
+
+// Elige la implementacion mas rapida que soporta la CPU y devuelve su nombre.
+// Debe llamarse antes de crear hilos; sin llamarla se usa la escalar.
+const char *ventana_iniciar(void);
+
+int ventana_buscar(const int32_t *ocupacion, int desde, int hasta, int largo,
+                   int32_t limite);
+
+// Implementaciones soportadas por esta CPU, de la mas simple a la mas rapida
+// (para pruebas y mediciones). Devuelve cuantas hay.
+int ventana_implementaciones(const ImplementacionVentana **lista);
+
+#endif